@@ -1,5 +1,7 @@
 #include "mold.h"
 
+#include <unordered_map>
+
 struct ArHdr {
   char ar_name[16];
   char ar_date[12];
@@ -10,9 +12,11 @@ struct ArHdr {
   char ar_fmag[2];
 };
 
-std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb) {
+// Returns paths of thin archive members. This doesn't access member
+// files, so that callers can open them lazily or in parallel.
+std::vector<std::string> read_thin_archive_paths(MemoryMappedFile *mb) {
   u8 *data = mb->data() + 8;
-  std::vector<MemoryMappedFile *> vec;
+  std::vector<std::string> vec;
   std::string_view strtab;
   std::string basedir = mb->name.substr(0, mb->name.find_last_of('/'));
 
@@ -27,7 +31,7 @@ std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb)
       continue;
     }
 
-    if (!memcmp(hdr.ar_name, "/ ", 2)) {
+    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "/SYM64/", 7)) {
       data = body + size;
       continue;
     }
@@ -36,14 +40,19 @@ std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb)
       Fatal() << mb->name << ": filename is not stored as a long filename";
 
     const char *start = strtab.data() + atoi(hdr.ar_name + 1);
-    std::string name(start, strstr(start, "/\n"));
-
-    vec.push_back(MemoryMappedFile::must_open(basedir + "/" + name));
+    vec.push_back(basedir + "/" + std::string(start, strstr(start, "/\n")));
     data = body;
   }
   return vec;
 }
 
+std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb) {
+  std::vector<MemoryMappedFile *> vec;
+  for (std::string &path : read_thin_archive_paths(mb))
+    vec.push_back(MemoryMappedFile::must_open(path));
+  return vec;
+}
+
 std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb) {
   u8 *data = mb->data() + 8;
   std::vector<MemoryMappedFile *> vec;
@@ -60,7 +69,8 @@ std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb) {
       continue;
     }
 
-    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "__.SYMDEF/", 10))
+    if (!memcmp(hdr.ar_name, "/ ", 2) || !memcmp(hdr.ar_name, "/SYM64/", 7) ||
+        !memcmp(hdr.ar_name, "__.SYMDEF/", 10))
       continue;
 
     std::string name;
@@ -88,3 +98,82 @@ std::vector<MemoryMappedFile *> read_archive_members(MemoryMappedFile *mb) {
     return read_thin_archive_members(mb);
   return read_fat_archive_members(mb);
 }
+
+template <typename T>
+static T read_be(u8 *p) {
+  T val = 0;
+  for (int i = 0; i < sizeof(T); i++)
+    val = (val << 8) | p[i];
+  return val;
+}
+
+// Reads a GNU-style archive symbol table, which consists of a symbol
+// count, member header offsets for the symbols, and symbol names.
+// The table uses 32-bit words ("/") or 64-bit words ("/SYM64/").
+template <typename T>
+static void
+read_symtab(std::unordered_map<u64, std::vector<std::string_view>> &map,
+            std::string_view name, u8 *body, u64 size) {
+  if (size < sizeof(T))
+    Fatal() << name << ": corrupted archive symbol table";
+
+  u64 num_syms = read_be<T>(body);
+  u8 *offsets = body + sizeof(T);
+  char *strtab = (char *)offsets + num_syms * sizeof(T);
+  char *end = (char *)body + size;
+
+  if (end < strtab)
+    Fatal() << name << ": corrupted archive symbol table";
+
+  for (u64 i = 0; i < num_syms; i++) {
+    if (end <= strtab)
+      Fatal() << name << ": corrupted archive symbol table";
+    std::string_view sym(strtab, strnlen(strtab, end - strtab));
+    map[read_be<T>(offsets + i * sizeof(T))].push_back(sym);
+    strtab += sym.size() + 1;
+  }
+}
+
+// Returns a list of global symbol names defined by each member, in
+// the same order as read_archive_members returns members. If an
+// archive doesn't have a symbol table, an empty list is returned.
+std::vector<std::vector<std::string_view>>
+read_archive_symbols(MemoryMappedFile *mb) {
+  std::unordered_map<u64, std::vector<std::string_view>> map;
+  std::vector<std::vector<std::string_view>> vec;
+  bool has_symtab = false;
+  bool is_thin = !memcmp(mb->data(), "!<thin>\n", 8);
+  u8 *data = mb->data() + 8;
+
+  while (data < mb->data() + mb->size()) {
+    ArHdr &hdr = *(ArHdr *)data;
+    u8 *body = data + sizeof(hdr);
+    u64 size = atol(hdr.ar_size);
+    u64 offset = data - mb->data();
+    data = body + size;
+
+    if (!memcmp(hdr.ar_name, "/ ", 2)) {
+      read_symtab<u32>(map, mb->name, body, size);
+      has_symtab = true;
+      continue;
+    }
+
+    if (!memcmp(hdr.ar_name, "/SYM64/", 7)) {
+      read_symtab<u64>(map, mb->name, body, size);
+      has_symtab = true;
+      continue;
+    }
+
+    if (!memcmp(hdr.ar_name, "// ", 3) || !memcmp(hdr.ar_name, "__.SYMDEF/", 10))
+      continue;
+
+    // Thin archive members don't have bodies in the archive.
+    if (is_thin)
+      data = body;
+    vec.push_back(std::move(map[offset]));
+  }
+
+  if (!has_symtab)
+    return {};
+  return vec;
+}
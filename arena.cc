@@ -0,0 +1,40 @@
+#include "mold.h"
+
+static constexpr u64 SLAB_SIZE = 1024 * 1024;
+
+static std::string get_arena_name() {
+  static std::atomic_int num_arenas;
+  return "arena" + std::to_string(num_arenas++) + "_kib";
+}
+
+// Each arena reports the number of KiB it has allocated in --stat.
+Arena::Arena() : name(get_arena_name()) {}
+
+void *Arena::allocate_slow(u64 size, u64 align) {
+  static Counter total("arena_kib");
+
+  // Large objects get their own memory so that they don't waste
+  // the rest of the current slab.
+  // Sizes may come from input files, so they can be arbitrarily large.
+  if (size + align > SLAB_SIZE / 4) {
+    u8 *buf = nullptr;
+    if (size < SIZE_MAX - align)
+      buf = (u8 *)malloc(size + align);
+    if (!buf)
+      Fatal() << "out of memory: cannot allocate " << size << " bytes";
+
+    counter.inc((size + align) / 1024);
+    total.inc((size + align) / 1024);
+    return (void *)(((uintptr_t)buf + align - 1) & ~(uintptr_t)(align - 1));
+  }
+
+  u8 *buf = (u8 *)malloc(SLAB_SIZE);
+  if (!buf)
+    Fatal() << "out of memory: cannot allocate " << SLAB_SIZE << " bytes";
+
+  counter.inc(SLAB_SIZE / 1024);
+  total.inc(SLAB_SIZE / 1024);
+  cur = buf;
+  end = cur + SLAB_SIZE;
+  return allocate(size, align);
+}
@@ -0,0 +1,109 @@
+// A microbenchmark for ConcurrentMap. It interns the same set of keys
+// as a typical link does, i.e. each symbol name is inserted a few
+// times from multiple threads, and compares the result with
+// tbb::concurrent_hash_map, which ConcurrentMap used to be based on.
+//
+// Usage: bench/concurrent-map [num-keys [num-inserts-per-key]]
+
+#include "../mold.h"
+
+#include <chrono>
+#include <random>
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/parallel_for.h>
+
+namespace tbb {
+template<>
+struct tbb_hash_compare<std::string_view> {
+  static size_t hash(const std::string_view& k) {
+    return std::hash<std::string_view>()(k);
+  }
+
+  static bool equal(const std::string_view& k1, const std::string_view& k2) {
+    return k1 == k2;
+  }
+};
+}
+
+// Fatal() calls this to clean up before exiting.
+void cleanup() {}
+
+struct Value {
+  std::string_view name;
+  u64 data[6] = {};
+};
+
+template<typename Fn>
+static void run(std::string name, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  auto end = std::chrono::steady_clock::now();
+  std::chrono::duration<double, std::milli> elapsed = end - start;
+  std::cout << name << ": " << elapsed.count() << " ms\n";
+}
+
+int main(int argc, char **argv) {
+  i64 num_keys = (argc > 1) ? atol(argv[1]) : 2000000;
+  i64 num_dups = (argc > 2) ? atol(argv[2]) : 4;
+
+  std::vector<std::string> names(num_keys);
+  for (i64 i = 0; i < num_keys; i++)
+    names[i] = "_ZN4mold13some_function" + std::to_string(i) + "Ev";
+
+  std::vector<std::string_view> keys;
+  for (i64 i = 0; i < num_dups; i++)
+    for (std::string &name : names)
+      keys.push_back(name);
+  std::shuffle(keys.begin(), keys.end(), std::mt19937_64(1));
+
+  std::cout << keys.size() << " inserts of " << num_keys << " keys\n";
+
+  run("tbb::concurrent_hash_map", [&]() {
+    typedef tbb::concurrent_hash_map<std::string_view, Value> MapT;
+    MapT map;
+    tbb::parallel_for((i64)0, (i64)keys.size(), [&](i64 i) {
+      MapT::const_accessor acc;
+      map.insert(acc, std::make_pair(keys[i], Value{keys[i]}));
+    });
+  });
+
+  // Overflow tables don't grow, so we always reserve the map. This run
+  // reserves only half of the keys to measure the cost of overflow.
+  run("ConcurrentMap (half reserved)", [&]() {
+    ConcurrentMap<Value> map;
+    map.reserve(num_keys / 2);
+    tbb::parallel_for((i64)0, (i64)keys.size(), [&](i64 i) {
+      map.insert(keys[i], Value{keys[i]});
+    });
+  });
+
+  run("ConcurrentMap (reserved)", [&]() {
+    ConcurrentMap<Value> map;
+    map.reserve(num_keys);
+    tbb::parallel_for((i64)0, (i64)keys.size(), [&](i64 i) {
+      map.insert(keys[i], Value{keys[i]});
+    });
+  });
+
+  // Check that all threads agree on where each key lives, including
+  // keys in overflow tables.
+  ConcurrentMap<Value> map;
+  map.reserve(num_keys / 2);
+  std::vector<Value *> ptrs(keys.size());
+  tbb::parallel_for((i64)0, (i64)keys.size(), [&](i64 i) {
+    ptrs[i] = map.insert(keys[i], Value{keys[i]});
+  });
+
+  for (i64 i = 0; i < keys.size(); i++) {
+    if (ptrs[i]->name != keys[i] || ptrs[i] != map.insert(keys[i], {})) {
+      std::cerr << "broken map: " << keys[i] << "\n";
+      return 1;
+    }
+  }
+
+  if (map.size() != num_keys) {
+    std::cerr << "broken map: " << map.size() << " != " << num_keys << "\n";
+    return 1;
+  }
+  return 0;
+}
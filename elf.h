@@ -51,6 +51,8 @@ static constexpr u32 SHF_TLS = 0x400;
 static constexpr u32 SHF_COMPRESSED = 0x800;
 static constexpr u32 SHF_EXCLUDE = 0x80000000;
 
+static constexpr u32 ELFCOMPRESS_ZLIB = 1;
+
 static constexpr u32 GRP_COMDAT = 1;
 
 static constexpr u32 STT_NOTYPE = 0;
@@ -83,6 +85,7 @@ static constexpr u32 PT_NOTE = 4;
 static constexpr u32 PT_SHLIB = 5;
 static constexpr u32 PT_PHDR = 6;
 static constexpr u32 PT_TLS = 7;
+static constexpr u32 PT_GNU_EH_FRAME = 0x6474e550;
 static constexpr u32 PT_GNU_STACK = 0x6474e551;
 
 static constexpr u32 PF_X = 1;
@@ -141,6 +144,7 @@ static constexpr u32 DT_INIT_ARRAYSZ = 27;
 static constexpr u32 DT_FINI_ARRAYSZ = 28;
 static constexpr u32 DT_RUNPATH = 29;
 static constexpr u32 DT_FLAGS = 30;
+static constexpr u32 DT_GNU_HASH = 0x6ffffef5;
 static constexpr u32 DT_VERSYM = 0x6ffffff0;
 static constexpr u32 DT_RELACOUNT = 0x6ffffff9;
 static constexpr u32 DT_RELCOUNT = 0x6ffffffa;
@@ -202,6 +206,12 @@ static constexpr u32 R_X86_64_IRELATIVE = 37;
 static constexpr u32 R_X86_64_GOTPCRELX = 41;
 static constexpr u32 R_X86_64_REX_GOTPCRELX = 42;
 
+static constexpr u32 DW_EH_PE_absptr = 0;
+static constexpr u32 DW_EH_PE_udata4 = 0x03;
+static constexpr u32 DW_EH_PE_sdata4 = 0x0b;
+static constexpr u32 DW_EH_PE_pcrel = 0x10;
+static constexpr u32 DW_EH_PE_datarel = 0x30;
+
 struct ElfSym {
   bool is_defined() const { return !is_undef(); }
   bool is_undef() const { return st_shndx == SHN_UNDEF; }
@@ -265,6 +275,13 @@ struct ElfRela {
   i64 r_addend;
 };
 
+struct ElfChdr {
+  u32 ch_type;
+  u32 ch_reserved;
+  u64 ch_size;
+  u64 ch_addralign;
+};
+
 struct ElfDyn {
   u64 d_tag;
   u64 d_val;
@@ -0,0 +1,120 @@
+// This file implements a mark-sweep garbage collector for -gc-sections.
+// In this algorithm, vertices are sections and edges are relocations.
+// Any section that is reachable from a root section is considered alive.
+
+#include "mold.h"
+
+#include <tbb/parallel_do.h>
+#include <tbb/parallel_for_each.h>
+
+static bool mark_section(InputSection *isec) {
+  return isec && isec->is_alive && !isec->is_visited.exchange(true);
+}
+
+static void visit(InputSection *isec,
+                  tbb::parallel_do_feeder<InputSection *> &feeder) {
+  ObjectFile *file = isec->file;
+
+  auto enqueue = [&](const ElfRela &rel) {
+    InputSection *target = file->symbols[rel.r_sym]->input_section;
+    if (mark_section(target))
+      feeder.add(target);
+  };
+
+  for (const ElfRela &rel : isec->rels)
+    enqueue(rel);
+
+  // If a section is alive, its FDEs are alive too, and so are the
+  // sections they refer to (e.g. LSDAs in .gcc_except_table). The
+  // first relocation of an FDE points to the section itself.
+  for (int i = isec->fde_begin; i < isec->fde_end; i++)
+    for (const ElfRela &rel : file->fdes[i].rels.subspan(1))
+      enqueue(rel);
+}
+
+static std::vector<InputSection *> collect_root_set() {
+  Timer t("collect_root_set");
+
+  std::vector<std::vector<InputSection *>> vec(out::objs.size());
+
+  tbb::parallel_for(0, (int)out::objs.size(), [&](int i) {
+    ObjectFile *file = out::objs[i];
+
+    for (InputSection *isec : file->sections) {
+      if (!isec)
+        continue;
+
+      // Non-alloc sections (e.g. debug info) are always kept, but
+      // relocations from them don't keep other sections alive.
+      if (!(isec->shdr.sh_flags & SHF_ALLOC)) {
+        isec->is_visited = true;
+        continue;
+      }
+
+      // Sections that are not referenced by relocations but still
+      // needed at runtime, and sections that may be referenced via
+      // __start_ and __stop_ symbols.
+      if (is_init_fini(*isec) || isec->shdr.sh_type == SHT_NOTE ||
+          (!isec->name.starts_with(".") && is_c_identifier(isec->name)))
+        if (mark_section(isec))
+          vec[i].push_back(isec);
+    }
+
+    // Sections referenced by CIEs (e.g. personality routines) are roots.
+    for (CieRecord &cie : file->cies) {
+      for (const ElfRela &rel : cie.rels) {
+        InputSection *isec = file->symbols[rel.r_sym]->input_section;
+        if (mark_section(isec))
+          vec[i].push_back(isec);
+      }
+    }
+
+    // Exported symbols are roots.
+    if (config.export_dynamic)
+      for (Symbol *sym : std::span(file->symbols).subspan(file->first_global))
+        if (sym->file == file && mark_section(sym->input_section))
+          vec[i].push_back(sym->input_section);
+  });
+
+  std::vector<InputSection *> roots = flatten(vec);
+
+  auto enqueue_symbol = [&](std::string_view name) {
+    InputSection *isec = Symbol::intern(name)->input_section;
+    if (mark_section(isec))
+      roots.push_back(isec);
+  };
+
+  enqueue_symbol(config.entry);
+  for (std::string_view name : config.globals)
+    enqueue_symbol(name);
+  return roots;
+}
+
+static void sweep() {
+  Timer t("sweep");
+  static Counter counter("garbage_sections");
+
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    for (InputSection *&isec : file->sections) {
+      if (isec && isec->is_alive && !isec->is_visited) {
+        isec->is_alive = false;
+        isec = nullptr;
+        counter.inc();
+      }
+    }
+  });
+}
+
+void gc_sections() {
+  Timer t("gc");
+
+  std::vector<InputSection *> roots = collect_root_set();
+
+  tbb::parallel_do(
+    roots,
+    [&](InputSection *isec, tbb::parallel_do_feeder<InputSection *> &feeder) {
+      visit(isec, feeder);
+    });
+
+  sweep();
+}
@@ -0,0 +1,308 @@
+// This file implements Identical Code Folding. Two sections are
+// considered identical if they have the same contents and attributes,
+// and their relocations refer the same targets or targets that are
+// themselves identical.
+//
+// We first compute a digest for each eligible section from its
+// contents and relocations, treating references to other eligible
+// sections as edges of a graph. We then repeatedly mix each section's
+// digest with the digests of its edges until the number of distinct
+// digests stops growing. At that point, sections with the same digest
+// are in the same equivalence class and can be merged into one.
+
+#include "mold.h"
+
+#include <openssl/sha.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
+
+static constexpr int DIGEST_SIZE = 16;
+
+typedef std::array<u8, DIGEST_SIZE> Digest;
+
+static bool is_eligible(InputSection &isec) {
+  const ElfShdr &shdr = isec.shdr;
+
+  bool is_alloc = (shdr.sh_flags & SHF_ALLOC);
+  bool is_writable = (shdr.sh_flags & SHF_WRITE);
+  bool is_exec = (shdr.sh_flags & SHF_EXECINSTR);
+  bool is_bss = (shdr.sh_type == SHT_NOBITS);
+
+  if (!is_alloc || is_writable || is_bss || shdr.sh_size == 0)
+    return false;
+  if (is_init_fini(isec) || shdr.sh_type == SHT_NOTE ||
+      (!isec.name.starts_with(".") && is_c_identifier(isec.name)))
+    return false;
+
+  // In the safe mode, we merge only functions whose addresses are
+  // never taken, since a program may compare function pointers.
+  if (!config.icf_all)
+    return is_exec && !isec.is_address_taken;
+  return true;
+}
+
+// Returns true if a relocation is a direct call or jump, which does
+// not take the address of the target. Only code can contain such
+// instructions; bytes in data sections are not opcodes.
+static bool is_branch(InputSection &isec, const ElfRela &rel) {
+  if (!(isec.shdr.sh_flags & SHF_EXECINSTR))
+    return false;
+  if (rel.r_type != R_X86_64_PC32 && rel.r_type != R_X86_64_PLT32)
+    return false;
+  if (rel.r_offset == 0)
+    return false;
+
+  u8 op = isec.contents[rel.r_offset - 1];
+  return op == 0xe8 || op == 0xe9;
+}
+
+static void mark_address_taken_sections() {
+  Timer t("mark_address_taken");
+
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    for (InputSection *isec : file->sections) {
+      if (!isec || !(isec->shdr.sh_flags & SHF_ALLOC))
+        continue;
+
+      for (const ElfRela &rel : isec->rels) {
+        InputSection *target = file->symbols[rel.r_sym]->input_section;
+        if (target && !is_branch(*isec, rel))
+          target->is_address_taken = true;
+      }
+    }
+
+    // Exported symbols may be compared by other modules.
+    if (config.export_dynamic) {
+      for (Symbol *sym : std::span(file->symbols).subspan(file->first_global))
+        if (sym->file == file && sym->input_section)
+          sym->input_section->is_address_taken = true;
+    }
+  });
+
+  for (std::string_view name : config.globals)
+    if (InputSection *isec = Symbol::intern(name)->input_section)
+      isec->is_address_taken = true;
+
+  if (InputSection *isec = Symbol::intern(config.entry)->input_section)
+    isec->is_address_taken = true;
+}
+
+static std::vector<InputSection *> collect_sections() {
+  Timer t("collect_sections");
+
+  std::vector<ObjectFile *> files = out::objs;
+  sort(files, [](ObjectFile *a, ObjectFile *b) {
+    return a->priority < b->priority;
+  });
+
+  std::vector<std::vector<InputSection *>> vec(files.size());
+
+  tbb::parallel_for(0, (int)files.size(), [&](int i) {
+    for (InputSection *isec : files[i]->sections)
+      if (isec && isec->is_alive && is_eligible(*isec))
+        vec[i].push_back(isec);
+  });
+
+  std::vector<InputSection *> sections = flatten(vec);
+
+  tbb::parallel_for(0, (int)sections.size(), [&](int i) {
+    sections[i]->icf_idx = i;
+  });
+  return sections;
+}
+
+static Digest compute_digest(InputSection &isec, std::vector<u32> &edges) {
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+
+  auto hash = [&](auto val) {
+    SHA256_Update(&ctx, &val, sizeof(val));
+  };
+
+  auto hash_string = [&](std::string_view str) {
+    hash(str.size());
+    SHA256_Update(&ctx, str.data(), str.size());
+  };
+
+  hash_string(isec.contents);
+  hash(isec.shdr.sh_type);
+  hash(isec.shdr.sh_flags);
+  hash(isec.shdr.sh_entsize);
+  hash(isec.shdr.sh_addralign);
+
+  auto hash_symbol = [&](Symbol &sym) {
+    if (sym.piece_ref.piece) {
+      hash('p');
+      hash(sym.piece_ref.piece);
+      hash(sym.piece_ref.addend);
+    } else if (sym.input_section && sym.input_section->icf_idx != -1) {
+      hash('e');
+      hash(sym.value);
+      edges.push_back(sym.input_section->icf_idx);
+    } else if (sym.input_section) {
+      hash('s');
+      hash(sym.input_section);
+      hash(sym.value);
+    } else {
+      hash('a');
+      hash(&sym);
+    }
+  };
+
+  int ref_idx = 0;
+
+  for (int i = 0; i < isec.rels.size(); i++) {
+    const ElfRela &rel = isec.rels[i];
+
+    hash(rel.r_offset);
+    hash(rel.r_type);
+
+    if (isec.has_rel_piece[i]) {
+      StringPieceRef &ref = isec.rel_pieces[ref_idx++];
+      hash('p');
+      hash(ref.piece);
+      hash(ref.addend);
+      continue;
+    }
+
+    hash(rel.r_addend);
+    hash_symbol(*isec.file->symbols[rel.r_sym]);
+  }
+
+  // Sections with different unwind info (e.g. different LSDAs) must
+  // not be merged. Skip the first relocation, which refers the section
+  // itself, and the CIE pointer field.
+  for (int i = isec.fde_begin; i < isec.fde_end; i++) {
+    FdeRecord &fde = isec.file->fdes[i];
+    hash_string(fde.contents.substr(8));
+    hash_string(isec.file->cies[fde.cie_idx].contents);
+
+    for (const ElfRela &rel : fde.rels.subspan(1)) {
+      hash(rel.r_offset - fde.input_offset);
+      hash(rel.r_type);
+      hash(rel.r_addend);
+      hash_symbol(*isec.file->symbols[rel.r_sym]);
+    }
+  }
+
+  u8 buf[SHA256_SIZE];
+  SHA256_Final(buf, &ctx);
+
+  Digest digest;
+  memcpy(digest.data(), buf, DIGEST_SIZE);
+  return digest;
+}
+
+static Digest propagate(const Digest &digest, std::span<u32> edges,
+                        std::vector<Digest> &digests) {
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  SHA256_Update(&ctx, digest.data(), DIGEST_SIZE);
+  for (u32 i : edges)
+    SHA256_Update(&ctx, digests[i].data(), DIGEST_SIZE);
+
+  u8 buf[SHA256_SIZE];
+  SHA256_Final(buf, &ctx);
+
+  Digest ret;
+  memcpy(ret.data(), buf, DIGEST_SIZE);
+  return ret;
+}
+
+static i64 count_classes(std::vector<Digest> &digests) {
+  std::vector<Digest> vec = digests;
+  tbb::parallel_sort(vec.begin(), vec.end());
+  return std::unique(vec.begin(), vec.end()) - vec.begin();
+}
+
+void icf_sections() {
+  Timer t("icf");
+
+  if (!config.icf_all)
+    mark_address_taken_sections();
+
+  std::vector<InputSection *> sections = collect_sections();
+  std::vector<std::vector<u32>> edges(sections.size());
+  std::vector<Digest> digests(sections.size());
+
+  {
+    Timer t2("compute_digests");
+    tbb::parallel_for(0, (int)sections.size(), [&](int i) {
+      digests[i] = compute_digest(*sections[i], edges[i]);
+    });
+  }
+
+  // Refine equivalence classes until they reach a fixed point.
+  {
+    Timer t2("propagate");
+    static Counter rounds("icf_rounds");
+
+    std::vector<Digest> next(sections.size());
+    i64 num_classes = count_classes(digests);
+
+    for (;;) {
+      rounds.inc();
+
+      tbb::parallel_for(0, (int)sections.size(), [&](int i) {
+        if (edges[i].empty())
+          next[i] = digests[i];
+        else
+          next[i] = propagate(digests[i], edges[i], digests);
+      });
+
+      std::swap(digests, next);
+
+      i64 n = count_classes(digests);
+      if (n == num_classes)
+        break;
+      num_classes = n;
+    }
+  }
+
+  // Group sections by digest. Sections were collected in priority
+  // order, so the first section in each group becomes the leader.
+  {
+    Timer t2("merge");
+
+    std::vector<u32> indices(sections.size());
+    for (int i = 0; i < indices.size(); i++)
+      indices[i] = i;
+
+    tbb::parallel_sort(indices.begin(), indices.end(), [&](u32 a, u32 b) {
+      return std::tie(digests[a], a) < std::tie(digests[b], b);
+    });
+
+    tbb::parallel_for(0, (int)indices.size(), [&](int i) {
+      if (i > 0 && digests[indices[i - 1]] == digests[indices[i]])
+        return;
+
+      InputSection *leader = sections[indices[i]];
+      for (int j = i + 1; j < indices.size(); j++) {
+        if (digests[indices[i]] != digests[indices[j]])
+          break;
+        sections[indices[j]]->leader = leader;
+      }
+    });
+  }
+
+  // Remove folded sections and redirect symbols to their leaders.
+  static Counter counter("icf_sections");
+
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    for (InputSection *&isec : file->sections) {
+      if (isec && isec->leader) {
+        isec->is_alive = false;
+        isec = nullptr;
+        counter.inc();
+      }
+    }
+
+    for (int i = 0; i < file->symbols.size(); i++) {
+      Symbol *sym = file->symbols[i];
+      if (i >= file->first_global && sym->file != file)
+        continue;
+      if (sym->input_section && sym->input_section->leader)
+        sym->input_section = sym->input_section->leader;
+    }
+  });
+}
@@ -0,0 +1,397 @@
+// This file implements --incremental. In the usual edit-compile-link
+// cycle, only a few object files change between two links. If we
+// reserve some padding after each input section, a changed section is
+// likely to still fit in its previous slot, in which case the file
+// layout stays the same and we can patch the previous output in place
+// instead of writing the entire file.
+//
+// We always run symbol resolution and layout as usual, because they
+// are cheap compared to copying. Then we compare a digest of the new
+// layout with the one from the previous link. The digest covers
+// everything that unchanged sections depend on, i.e. section offsets
+// and addresses, symbol addresses and GOT/PLT indices, merged string
+// offsets and dynamic relocation offsets. If the digests match, bytes
+// that come from unchanged files are already correct in the output,
+// so we rewrite only sections of changed files and linker-synthesized
+// sections. Otherwise, we fall back to a full link.
+//
+// The state is saved to <output>.incremental after each link.
+
+#include "mold.h"
+
+#include <fcntl.h>
+#include <fstream>
+#include <openssl/sha.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tbb/parallel_for_each.h>
+#include <unordered_map>
+
+typedef std::array<u8, SHA256_SIZE> Digest;
+
+namespace {
+struct FileState {
+  u64 size = 0;
+  u64 mtime = 0;
+  std::vector<u32> reserved_sizes;
+};
+
+struct State {
+  std::string args_digest;
+  std::string layout_digest;
+  u64 output_size = 0;
+  u64 output_mtime = 0;
+  std::unordered_map<std::string, FileState> files;
+};
+}
+
+static const char *MAGIC = "mold-incremental-1";
+
+static State prev;
+static std::string args_digest;
+static std::string layout_digest;
+static std::vector<ObjectFile *> changed_files;
+
+static std::string get_state_path() {
+  return config.output + ".incremental";
+}
+
+static std::string get_file_key(ObjectFile *file) {
+  if (file->archive_name.empty())
+    return file->name;
+  return file->archive_name + "(" + file->name + ")";
+}
+
+static std::string to_hex(const u8 *buf, int size) {
+  static const char digits[] = "0123456789abcdef";
+  std::string str;
+  for (int i = 0; i < size; i++) {
+    str += digits[buf[i] >> 4];
+    str += digits[buf[i] & 0xf];
+  }
+  return str;
+}
+
+// Sections that are concatenated to form a single array or function
+// (e.g. .init_array or .init), notes and debug info must not have gaps.
+static bool can_have_padding(InputSection &isec) {
+  return (isec.shdr.sh_flags & SHF_ALLOC) && !is_init_fini(isec) &&
+         isec.shdr.sh_type != SHT_NOTE &&
+         (isec.name.starts_with(".") || !is_c_identifier(isec.name));
+}
+
+// We reserve 25% + 16 bytes extra space for each section.
+static u32 get_reserved_size(u64 size) {
+  if (size == 0)
+    return 0;
+  return size + size / 4 + 16;
+}
+
+static bool stat_output(u64 &size, u64 &mtime) {
+  struct stat st;
+  if (stat(config.output.c_str(), &st) == -1)
+    return false;
+  size = st.st_size;
+  mtime = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  return true;
+}
+
+static bool read_state(State &state) {
+  std::ifstream in(get_state_path());
+  if (!in)
+    return false;
+
+  std::string magic;
+  in >> magic;
+  if (magic != MAGIC)
+    return false;
+
+  in >> state.args_digest >> state.layout_digest
+     >> state.output_size >> state.output_mtime;
+  in.ignore();
+
+  // Each file is described by two lines. The first line contains
+  // a file name, and the second contains its size, mtime and
+  // reserved sizes of its sections.
+  std::string key;
+  while (std::getline(in, key)) {
+    FileState &file = state.files[key];
+    u64 num_sections;
+    in >> file.size >> file.mtime >> num_sections;
+    file.reserved_sizes.resize(num_sections);
+    for (u32 &size : file.reserved_sizes)
+      in >> size;
+    in.ignore();
+    if (!in)
+      return false;
+  }
+  return true;
+}
+
+void load_incremental_state(std::span<std::string_view> args) {
+  Timer t("load_incremental_state");
+
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  for (std::string_view arg : args)
+    SHA256_Update(&ctx, arg.data(), arg.size() + 1);
+
+  u8 buf[SHA256_SIZE];
+  SHA256_Final(buf, &ctx);
+  args_digest = to_hex(buf, SHA256_SIZE);
+
+  if (!read_state(prev))
+    prev = {};
+
+  std::vector<ObjectFile *> changed(out::objs.size());
+
+  // Sections keep their previous slots if they still fit in them.
+  tbb::parallel_for(0, (int)out::objs.size(), [&](int i) {
+    ObjectFile *file = out::objs[i];
+    FileState *state = nullptr;
+
+    if (auto it = prev.files.find(get_file_key(file)); it != prev.files.end()) {
+      state = &it->second;
+      if (state->size != file->mb->size() || state->mtime != file->mb->mtime)
+        changed[i] = file;
+    }
+
+    for (int j = 0; j < file->sections.size(); j++) {
+      InputSection *isec = file->sections[j];
+      if (!isec)
+        continue;
+
+      u64 size = isec->shdr.sh_size;
+      if (!can_have_padding(*isec))
+        isec->reserved_size = size;
+      else if (state && j < state->reserved_sizes.size() &&
+               size <= state->reserved_sizes[j])
+        isec->reserved_size = state->reserved_sizes[j];
+      else
+        isec->reserved_size = get_reserved_size(size);
+    }
+  });
+
+  changed_files.clear();
+  for (ObjectFile *file : changed)
+    if (file)
+      changed_files.push_back(file);
+}
+
+static Digest compute_file_digest(InputFile *file) {
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+
+  auto hash = [&](auto val) {
+    SHA256_Update(&ctx, &val, sizeof(val));
+  };
+
+  auto hash_string = [&](std::string_view str) {
+    hash(str.size());
+    SHA256_Update(&ctx, str.data(), str.size());
+  };
+
+  auto hash_symbol = [&](Symbol &sym) {
+    hash_string(sym.name);
+    if (!sym.file || !sym.file->is_dso || sym.has_copyrel)
+      hash(sym.get_addr());
+    hash(sym.aux().got_idx);
+    hash(sym.aux().gotplt_idx);
+    hash(sym.aux().gottpoff_idx);
+    hash(sym.aux().tlsgd_idx);
+    hash(sym.aux().plt_idx);
+    hash(sym.aux().dynsym_idx);
+    hash(sym.ver_idx);
+    hash((bool)sym.is_imported);
+    hash((bool)sym.has_copyrel);
+  };
+
+  hash_string(file->name);
+
+  if (file->is_dso) {
+    for (Symbol *sym : file->symbols)
+      if (sym->file == file)
+        hash_symbol(*sym);
+  } else {
+    ObjectFile *obj = (ObjectFile *)file;
+    hash(obj->reldyn_offset);
+    hash(obj->num_dynrel);
+
+    for (InputSection *isec : obj->sections) {
+      if (isec && isec->output_section) {
+        hash(isec->get_addr());
+        hash(isec->output_section->shdr.sh_offset + isec->offset);
+        hash(isec->reserved_size);
+        hash(isec->reldyn_offset);
+      } else {
+        hash(-1);
+      }
+    }
+
+    for (int i = 0; i < obj->symbols.size(); i++) {
+      Symbol *sym = obj->symbols[i];
+      if (i < obj->first_global || sym->file == obj)
+        hash_symbol(*sym);
+    }
+  }
+
+  Digest digest;
+  SHA256_Final(digest.data(), &ctx);
+  return digest;
+}
+
+static std::string compute_layout_digest() {
+  Timer t("layout_digest");
+
+  std::vector<InputFile *> files;
+  for (ObjectFile *file : out::objs)
+    files.push_back(file);
+  sort(files, [](InputFile *a, InputFile *b) {
+    return a->priority < b->priority;
+  });
+  for (SharedFile *file : out::dsos)
+    files.push_back(file);
+
+  std::vector<Digest> digests(files.size());
+  tbb::parallel_for(0, (int)files.size(), [&](int i) {
+    digests[i] = compute_file_digest(files[i]);
+  });
+
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+
+  auto hash = [&](auto val) {
+    SHA256_Update(&ctx, &val, sizeof(val));
+  };
+
+  for (OutputChunk *chunk : out::chunks) {
+    SHA256_Update(&ctx, chunk->name.data(), chunk->name.size());
+    hash(chunk->shndx);
+    hash(chunk->shdr);
+  }
+
+  hash(out::tls_begin);
+  hash(out::tls_end);
+
+  for (Digest &digest : digests)
+    SHA256_Update(&ctx, digest.data(), digest.size());
+
+  // Merged strings are stored in a hash table, so the iteration order
+  // is not deterministic. We use a commutative sum instead.
+  for (MergedSection *osec : MergedSection::instances) {
+    u64 sum = 0;
+    osec->map.for_each_value([&](const StringPiece &piece) {
+      if (!piece.isec)
+        return;
+      std::string_view data(piece.data, piece.size);
+      u64 h = hash_string(data);
+      sum += h ^ (piece.get_addr() * 0x9e3779b97f4a7c15);
+    });
+    hash(sum);
+  }
+
+  u8 buf[SHA256_SIZE];
+  SHA256_Final(buf, &ctx);
+  return to_hex(buf, SHA256_SIZE);
+}
+
+static u8 *map_output(u64 filesize) {
+  int fd = ::open(config.output.c_str(), O_RDWR);
+  if (fd == -1)
+    return nullptr;
+
+  u8 *buf = (u8 *)mmap(nullptr, filesize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  ::close(fd);
+  return (buf == MAP_FAILED) ? nullptr : buf;
+}
+
+// Patches the previous output file in place. Returns false if the
+// file layout has changed since the last link.
+bool incremental_link(u64 filesize) {
+  Timer t("incremental_link");
+
+  layout_digest = compute_layout_digest();
+
+  u64 size, mtime;
+  if (config.compress_debug_sections ||
+      prev.args_digest != args_digest ||
+      prev.layout_digest != layout_digest ||
+      !stat_output(size, mtime) ||
+      size != filesize || size != prev.output_size ||
+      mtime != prev.output_mtime)
+    return false;
+
+  u8 *buf = map_output(filesize);
+  if (!buf)
+    return false;
+  out::buf = buf;
+
+  static Counter counter("incremental_files");
+  counter.inc(changed_files.size());
+
+  // Rewrite sections of changed files.
+  tbb::parallel_for_each(changed_files, [](ObjectFile *file) {
+    for (InputSection *isec : file->sections) {
+      if (!isec || isec->shdr.sh_type == SHT_NOBITS)
+        continue;
+
+      isec->copy_buf();
+
+      // Zero-clear the rest of the slot
+      u8 *base = out::buf + isec->output_section->shdr.sh_offset + isec->offset;
+      if (isec->shdr.sh_size < isec->reserved_size)
+        memset(base + isec->shdr.sh_size, 0,
+               isec->reserved_size - isec->shdr.sh_size);
+    }
+  });
+
+  // Linker-synthesized sections such as .symtab or .eh_frame may
+  // contain data from changed files, so rewrite them.
+  tbb::parallel_for_each(out::chunks, [&](OutputChunk *chunk) {
+    if (chunk->kind != OutputChunk::REGULAR)
+      chunk->copy_buf();
+  });
+  Error::checkpoint();
+
+  if (out::buildid)
+    out::buildid->write_buildid(filesize);
+
+  munmap(buf, filesize);
+  save_incremental_state();
+  return true;
+}
+
+void save_incremental_state() {
+  Timer t("save_incremental_state");
+
+  if (layout_digest.empty())
+    layout_digest = compute_layout_digest();
+
+  u64 size = 0, mtime = 0;
+  stat_output(size, mtime);
+
+  std::string path = get_state_path();
+  std::string tmp = path + ".tmp";
+  std::ofstream out(tmp);
+  if (!out)
+    Fatal() << "cannot open " << tmp << ": " << strerror(errno);
+
+  out << MAGIC << "\n" << args_digest << "\n" << layout_digest << "\n"
+      << size << " " << mtime << "\n";
+
+  for (ObjectFile *file : out::objs) {
+    if (file == out::internal_file)
+      continue;
+
+    out << get_file_key(file) << "\n"
+        << file->mb->size() << " " << file->mb->mtime << " "
+        << file->sections.size();
+    for (InputSection *isec : file->sections)
+      out << " " << (isec ? isec->reserved_size : 0);
+    out << "\n";
+  }
+
+  out.close();
+  if (!out || rename(tmp.c_str(), path.c_str()) == -1)
+    Fatal() << "cannot write " << path << ": " << strerror(errno);
+}
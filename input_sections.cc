@@ -1,5 +1,9 @@
 #include "mold.h"
 
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
 InputChunk::InputChunk(ObjectFile *file, const ElfShdr &shdr,
                        std::string_view name)
   : file(file), shdr(shdr), name(name),
@@ -142,7 +146,6 @@ void InputSection::copy_buf() {
 }
 
 void InputSection::copy_contents(u8 *base) {
-  std::string_view contents = file->get_string(shdr);
   memcpy(base, contents.data(), contents.size());
 }
 
@@ -169,7 +172,7 @@ void InputSection::apply_reloc_alloc(u8 *base) {
     };
 
 #define S   (ref ? ref->piece->get_addr() \
-             : (sym.plt_idx == -1 ? sym.get_addr() : sym.get_plt_addr()))
+             : (sym.aux().plt_idx == -1 ? sym.get_addr() : sym.get_plt_addr()))
 #define A   (ref ? ref->addend : rel.r_addend)
 #define P   (output_section->shdr.sh_addr + offset + rel.r_offset)
 #define G   (sym.get_got_addr() - out::got->shdr.sh_addr)
@@ -186,7 +189,7 @@ void InputSection::apply_reloc_alloc(u8 *base) {
       *dynrel++ = {P, R_X86_64_RELATIVE, 0, (i64)(S + A)};
       break;
     case R_DYN:
-      *dynrel++ = {P, R_X86_64_64, sym.dynsym_idx, A};
+      *dynrel++ = {P, R_X86_64_64, sym.aux().dynsym_idx, A};
       break;
     case R_PC:
       write(S + A - P);
@@ -444,26 +447,138 @@ void InputSection::scan_relocations() {
   }
 }
 
+// Calls a given function with the offset of each NUL byte in a given
+// string. This is the hot loop when linking programs with large
+// .debug_str sections, so we scan 32 or 16 bytes at a time using SIMD
+// instructions if available.
+#ifdef __x86_64__
+template <typename Fn>
+__attribute__((target("avx2")))
+static void find_nulls_avx2(std::string_view data, Fn fn) {
+  const char *p = data.data();
+  i64 i = 0;
+
+  for (; i + 32 <= data.size(); i += 32) {
+    __m256i v = _mm256_loadu_si256((__m256i *)(p + i));
+    u32 mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+    for (; mask; mask &= mask - 1)
+      fn(i + __builtin_ctz(mask));
+  }
+
+  for (; i < data.size(); i++)
+    if (p[i] == '\0')
+      fn(i);
+}
+
+template <typename Fn>
+static void find_nulls_sse2(std::string_view data, Fn fn) {
+  const char *p = data.data();
+  i64 i = 0;
+
+  for (; i + 16 <= data.size(); i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i *)(p + i));
+    u32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+    for (; mask; mask &= mask - 1)
+      fn(i + __builtin_ctz(mask));
+  }
+
+  for (; i < data.size(); i++)
+    if (p[i] == '\0')
+      fn(i);
+}
+#endif
+
+template <typename Fn>
+static void find_nulls(std::string_view data, Fn fn) {
+#ifdef __x86_64__
+  static bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    find_nulls_avx2(data, fn);
+  else
+    find_nulls_sse2(data, fn);
+#else
+  const char *begin = data.data();
+  const char *end = begin + data.size();
+  for (const char *p = begin; (p = (char *)memchr(p, '\0', end - p)); p++)
+    fn(p - begin);
+#endif
+}
+
+// Calls a given function with the offset of each NUL character in a
+// string of `entsize`-byte characters.
+template <typename Fn>
+static void find_wide_nulls(std::string_view data, u32 entsize, Fn fn) {
+  static const char zero[16] = {};
+  assert(entsize <= sizeof(zero));
+
+  for (u32 i = 0; i + entsize <= data.size(); i += entsize)
+    if (memcmp(data.data() + i, zero, entsize) == 0)
+      fn(i + entsize - 1);
+}
+
 MergeableSection::MergeableSection(InputSection *isec, std::string_view data)
   : InputChunk(isec->file, isec->shdr, isec->name),
     parent(*MergedSection::get_instance(isec->name, isec->shdr.sh_type,
-                                        isec->shdr.sh_flags)) {
-  u32 offset = 0;
+                                        isec->shdr.sh_flags,
+                                        isec->shdr.sh_entsize)),
+    contents(data) {
+  u32 entsize = shdr.sh_entsize;
+  bool is_string = (shdr.sh_flags & SHF_STRINGS);
+
+  if (is_string && entsize > 16)
+    Fatal() << *this << ": unsupported string entry size: " << entsize;
+
+  // Split the section into pieces and hash them while they are still
+  // in cache. A piece is a NUL-terminated string if SHF_STRINGS is
+  // set, or an entsize-byte record otherwise.
+  u32 begin = 0;
+
+  auto add = [&](u32 end) {
+    piece_offsets.push_back(begin);
+    hashes.push_back(hash_string(data.substr(begin, end + 1 - begin)));
+    begin = end + 1;
+  };
 
-  while (!data.empty()) {
-    size_t end = data.find('\0');
-    if (end == std::string_view::npos)
-      Error() << *this << ": string is not null terminated";
+  if (!is_string) {
+    for (u32 i = 0; i + entsize <= data.size(); i += entsize)
+      add(i + entsize - 1);
+  } else if (entsize == 1) {
+    find_nulls(data, add);
+  } else {
+    find_wide_nulls(data, entsize, add);
+  }
 
-    std::string_view substr = data.substr(0, end + 1);
-    data = data.substr(end + 1);
+  if (begin != data.size())
+    Error() << *this << ": string is not null terminated";
+
+  static Counter counter("string_pieces");
+  counter.inc(piece_offsets.size());
+}
 
-    StringPiece *piece = parent.map.insert(substr, StringPiece(substr));
-    pieces.push_back(piece);
-    piece_offsets.push_back(offset);
-    offset += substr.size();
+void MergeableSection::intern_pieces() {
+  // Insert strings to the map in batches. Most of the inserts miss the
+  // cache, so we prefetch slots for the next batch while inserting the
+  // current one.
+  static constexpr i64 BATCH_SIZE = 16;
+  i64 num_pieces = piece_offsets.size();
+  pieces.resize(num_pieces);
+
+  auto prefetch = [&](i64 begin) {
+    for (i64 i = begin; i < std::min(begin + BATCH_SIZE, num_pieces); i++)
+      parent.map.prefetch(hashes[i]);
+  };
+
+  prefetch(0);
+
+  for (i64 begin = 0; begin < num_pieces; begin += BATCH_SIZE) {
+    prefetch(begin + BATCH_SIZE);
+
+    for (i64 i = begin; i < std::min(begin + BATCH_SIZE, num_pieces); i++) {
+      u32 end = (i + 1 < num_pieces) ? piece_offsets[i + 1] : contents.size();
+      std::string_view substr = contents.substr(piece_offsets[i], end - piece_offsets[i]);
+      pieces[i] = parent.map.insert(substr, hashes[i], StringPiece(substr));
+    }
   }
 
-  static Counter counter("string_pieces");
-  counter.inc(pieces.size());
+  hashes = {};
 }
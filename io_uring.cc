@@ -0,0 +1,177 @@
+// This file implements reading input files with io_uring. We use raw
+// system calls instead of liburing, so that mold doesn't depend on it.
+//
+// Each thread has its own ring. A file is split into chunks, and reads
+// for the chunks are submitted in batches, so that the kernel can read
+// them in parallel. Unlike mmap'ed files, files read this way don't
+// cause page faults when they are parsed.
+
+#include "mold.h"
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static constexpr u32 QUEUE_DEPTH = 64;
+static constexpr u64 CHUNK_SIZE = 1024 * 1024;
+
+namespace {
+struct Ring {
+  int fd = -1;
+  u32 *sq_tail;
+  u32 *sq_mask;
+  u32 *sq_array;
+  u32 *cq_head;
+  u32 *cq_tail;
+  u32 *cq_mask;
+  io_uring_sqe *sqes;
+  io_uring_cqe *cqes;
+};
+}
+
+// Returns false if io_uring is not available, e.g. if the kernel is
+// too old or the system call is blocked by seccomp.
+static bool init_ring(Ring &ring) {
+  io_uring_params p = {};
+  int fd = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &p);
+  if (fd == -1)
+    return false;
+
+  u64 sq_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+  u64 cq_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = std::max(sq_size, cq_size);
+
+  u8 *sq = (u8 *)mmap(nullptr, sq_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  u8 *cq = sq;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq = (u8 *)mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) {
+      close(fd);
+      return false;
+    }
+  }
+
+  void *sqes = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe),
+                    PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  ring.fd = fd;
+  ring.sq_tail = (u32 *)(sq + p.sq_off.tail);
+  ring.sq_mask = (u32 *)(sq + p.sq_off.ring_mask);
+  ring.sq_array = (u32 *)(sq + p.sq_off.array);
+  ring.cq_head = (u32 *)(cq + p.cq_off.head);
+  ring.cq_tail = (u32 *)(cq + p.cq_off.tail);
+  ring.cq_mask = (u32 *)(cq + p.cq_off.ring_mask);
+  ring.sqes = (io_uring_sqe *)sqes;
+  ring.cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+  return true;
+}
+
+static Ring *get_ring() {
+  static std::atomic_bool is_disabled = false;
+  thread_local Ring ring;
+
+  if (ring.fd != -1)
+    return &ring;
+  if (is_disabled)
+    return nullptr;
+  if (init_ring(ring))
+    return &ring;
+  is_disabled = true;
+  return nullptr;
+}
+
+static void pread_full(int fd, u8 *buf, u64 size, u64 offset, std::string_view name) {
+  while (size > 0) {
+    ssize_t n = pread(fd, buf, size, offset);
+    if (n <= 0)
+      Fatal() << name << ": read failed: " << strerror(errno);
+    buf += n;
+    size -= n;
+    offset += n;
+  }
+}
+
+u8 *read_with_io_uring(int fd, u64 size, std::string_view name) {
+  static Counter counter("io_uring_bytes");
+
+  Ring *ring = get_ring();
+  if (!ring)
+    return nullptr;
+
+  u8 *buf = (u8 *)Arena::get().allocate(size, 4096);
+  u64 next = 0;
+  u32 pending = 0;
+  u32 inflight = 0;
+
+  while (next < size || pending > 0 || inflight > 0) {
+    // Fill the submission queue with reads for the following chunks.
+    u32 tail = *ring->sq_tail;
+
+    while (next < size && pending + inflight < QUEUE_DEPTH) {
+      u32 idx = tail & *ring->sq_mask;
+      u64 len = std::min(CHUNK_SIZE, size - next);
+
+      io_uring_sqe &sqe = ring->sqes[idx];
+      memset(&sqe, 0, sizeof(sqe));
+      sqe.opcode = IORING_OP_READ;
+      sqe.fd = fd;
+      sqe.addr = (u64)(buf + next);
+      sqe.len = len;
+      sqe.off = next;
+      sqe.user_data = next;
+      ring->sq_array[idx] = idx;
+
+      tail++;
+      next += len;
+      pending++;
+    }
+    __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+    // The kernel may consume fewer entries than we ask for. The rest
+    // stay in the submission queue and are submitted in the next
+    // iteration. We don't wait for completions in that case.
+    long n = syscall(__NR_io_uring_enter, ring->fd, pending, 1,
+                     IORING_ENTER_GETEVENTS, nullptr, 0);
+    if (n == -1) {
+      if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        Fatal() << name << ": io_uring_enter failed: " << strerror(errno);
+      n = 0;
+    }
+    pending -= n;
+    inflight += n;
+
+    // Reap completions. A short or failed read (e.g. IORING_OP_READ is
+    // not supported by the kernel) is completed with pread.
+    u32 head = *ring->cq_head;
+    while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+      io_uring_cqe &cqe = ring->cqes[head & *ring->cq_mask];
+      u64 off = cqe.user_data;
+      u64 len = std::min(CHUNK_SIZE, size - off);
+      u64 done = std::max(cqe.res, 0);
+
+      if (done < len)
+        pread_full(fd, buf + off + done, len - done, off + done, name);
+
+      head++;
+      inflight--;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+  }
+
+  counter.inc(size);
+  return buf;
+}
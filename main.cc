@@ -2,30 +2,40 @@
 
 #include <functional>
 #include <iostream>
+#include <dirent.h>
 #include <map>
 #include <signal.h>
+#include <sys/resource.h>
 #include <tbb/global_control.h>
 #include <tbb/parallel_do.h>
 #include <tbb/parallel_for_each.h>
-#include <tbb/task_group.h>
+#include <tbb/parallel_scan.h>
+#include <tbb/parallel_sort.h>
+#include <thread>
 #include <unordered_set>
 
-static tbb::task_group parser_tg;
+static std::vector<std::function<void()>> counter_tasks;
+static std::vector<std::function<void()>> parser_tasks;
+static std::vector<MemoryMappedFile *> input_files;
+static std::atomic_int64_t num_global_symbols;
+static std::atomic_int64_t num_comdat_groups;
 static bool preloading;
 
-static bool is_text_file(MemoryMappedFile *mb) {
-  return mb->size() >= 4 &&
-         isprint(mb->data()[0]) &&
-         isprint(mb->data()[1]) &&
-         isprint(mb->data()[2]) &&
-         isprint(mb->data()[3]);
+static bool is_text_file(std::string_view data) {
+  return data.size() >= 4 &&
+         isprint(data[0]) &&
+         isprint(data[1]) &&
+         isprint(data[2]) &&
+         isprint(data[3]);
 }
 
 enum class FileType { UNKNOWN, OBJ, DSO, AR, THIN_AR, TEXT };
 
 static FileType get_file_type(MemoryMappedFile *mb) {
-  if (mb->size() >= 20 && memcmp(mb->data(), "\177ELF", 4) == 0) {
-    ElfEhdr &ehdr = *(ElfEhdr *)mb->data();
+  std::string_view data = mb->peek(sizeof(ElfEhdr));
+
+  if (data.size() >= 20 && data.starts_with("\177ELF")) {
+    ElfEhdr &ehdr = *(ElfEhdr *)data.data();
     if (ehdr.e_type == ET_REL)
       return FileType::OBJ;
     if (ehdr.e_type == ET_DYN)
@@ -33,37 +43,137 @@ static FileType get_file_type(MemoryMappedFile *mb) {
     return FileType::UNKNOWN;
   }
 
-  if (mb->size() >= 8 && memcmp(mb->data(), "!<arch>\n", 8) == 0)
+  if (data.starts_with("!<arch>\n"))
     return FileType::AR;
-  if (mb->size() >= 8 && memcmp(mb->data(), "!<thin>\n", 8) == 0)
+  if (data.starts_with("!<thin>\n"))
     return FileType::THIN_AR;
-  if (is_text_file(mb))
+  if (is_text_file(data))
     return FileType::TEXT;
   return FileType::UNKNOWN;
 }
 
+// Parsing is deferred until all input files are opened, so that we
+// can pre-size the symbol table from the symbol counts in the ELF
+// headers before any thread starts interning symbols. Symbols are
+// counted in parallel too, because it touches each file's symbol table.
+static void run_parser(std::function<void()> fn) {
+  parser_tasks.push_back(fn);
+}
+
+static void run_counter(std::function<void()> fn) {
+  counter_tasks.push_back(fn);
+}
+
+// Runs tasks in parallel. The preload daemon forks a child process
+// for each link request. TBB's worker threads don't survive fork, so
+// the daemon uses plain threads instead of TBB.
+static void run_tasks(std::vector<std::function<void()>> &tasks) {
+  if (!preloading) {
+    tbb::parallel_for_each(tasks, [](std::function<void()> &fn) { fn(); });
+    return;
+  }
+
+  std::atomic_int idx = 0;
+  std::vector<std::thread> threads;
+
+  int num_threads = std::max<int>(std::thread::hardware_concurrency(), 1);
+  for (int i = 0; i < num_threads; i++) {
+    threads.emplace_back([&]() {
+      for (int j = idx++; j < tasks.size(); j = idx++)
+        tasks[j]();
+    });
+  }
+
+  for (std::thread &thread : threads)
+    thread.join();
+}
+
+static void wait_for_parsers() {
+  run_tasks(counter_tasks);
+  counter_tasks.clear();
+
+  Symbol::get_map().reserve(num_global_symbols);
+  ComdatGroup::get_map().reserve(num_comdat_groups);
+  num_global_symbols = 0;
+  num_comdat_groups = 0;
+
+  run_tasks(parser_tasks);
+  parser_tasks.clear();
+}
+
 static ObjectFile *new_object_file(MemoryMappedFile *mb, std::string archive_name) {
   ObjectFile *file = new ObjectFile(mb, archive_name);
-  parser_tg.run([=]() { file->parse(); });
+  run_counter([=]() {
+    num_global_symbols += file->count_defined_symbols();
+    num_comdat_groups += file->count_comdat_groups();
+  });
+  run_parser([=]() { file->parse(); });
+  return file;
+}
+
+// Archive members are not parsed until they are pulled out by symbol
+// resolution. Until then, they define only names in the archive symbol
+// table, or in their own ELF symbol tables if the archive has none.
+static ObjectFile *
+new_archive_member(MemoryMappedFile *mb, std::string archive_name,
+                   std::vector<std::vector<std::string_view>> &syms, int idx) {
+  ObjectFile *file = new ObjectFile(mb, archive_name);
+
+  // Members without an archive symbol table are counted from their
+  // own symbol tables, so that their names don't overflow the symbol
+  // table. Such members need to be opened to read their symbols anyway.
+  if (syms.empty()) {
+    run_counter([=]() { num_global_symbols += file->count_defined_symbols(); });
+    run_parser([=]() { file->read_lazy_symbols(); });
+  } else {
+    num_global_symbols += syms[idx].size();
+    run_parser([=, names = std::move(syms[idx])]() mutable {
+      file->read_lazy_symbols(names);
+    });
+  }
   return file;
 }
 
 static SharedFile *new_shared_file(MemoryMappedFile *mb, bool as_needed) {
   SharedFile *file = new SharedFile(mb, as_needed);
-  parser_tg.run([=]() { file->parse(); });
+  run_counter([=]() { num_global_symbols += file->count_defined_symbols(); });
+  run_parser([=]() { file->parse(); });
   return file;
 }
 
+// Parsed files are keyed by file identity rather than by path, so that
+// link commands run in different directories can share them.
 template <typename T>
 class FileCache {
 public:
   void store(MemoryMappedFile *mb, T *obj) {
-    Key k(mb->name, mb->size(), mb->mtime);
+    Key k = get_key(mb);
+
+    // Evict stale entries for the same file that has been modified
+    // in place since it was cached.
+    auto it = cache.lower_bound({mb->dev, mb->ino, 0, 0});
+    while (it != cache.end() && std::get<0>(it->first) == mb->dev &&
+           std::get<1>(it->first) == mb->ino) {
+      if (it->first == k)
+        it++;
+      else
+        it = cache.erase(it);
+    }
+
     cache[k].push_back(obj);
   }
 
+  bool empty() {
+    return cache.empty();
+  }
+
+  bool contains(MemoryMappedFile *mb) {
+    auto it = cache.find(get_key(mb));
+    return it != cache.end() && !it->second.empty();
+  }
+
   std::vector<T *> get(MemoryMappedFile *mb) {
-    Key k(mb->name, mb->size(), mb->mtime);
+    Key k = get_key(mb);
     std::vector<T *> objs = cache[k];
     cache[k].clear();
     return objs;
@@ -75,66 +185,108 @@ public:
   }
 
 private:
-  typedef std::tuple<std::string, u64, u64> Key;
+  typedef std::tuple<u64, u64, u64, u64> Key;
+
+  static Key get_key(MemoryMappedFile *mb) {
+    return {mb->dev, mb->ino, mb->size(), mb->mtime};
+  }
+
   std::map<Key, std::vector<T *>> cache;
 };
 
-void read_file(MemoryMappedFile *mb, bool as_needed) {
+static void read_file(MemoryMappedFile *mb, FileType type, bool as_needed) {
   static FileCache<ObjectFile> obj_cache;
   static FileCache<SharedFile> dso_cache;
+  static Counter preloaded("preloaded_files");
+
+  if (!preloading)
+    input_files.push_back(mb);
 
   if (preloading) {
-    switch (get_file_type(mb)) {
+    switch (type) {
     case FileType::OBJ:
-      obj_cache.store(mb, new_object_file(mb, ""));
+      watch_file(mb->name, mb->name);
+      if (!obj_cache.contains(mb))
+        obj_cache.store(mb, new_object_file(mb, ""));
       return;
     case FileType::DSO:
-      dso_cache.store(mb, new_shared_file(mb, as_needed));
+      watch_file(mb->name, mb->name);
+      if (!dso_cache.contains(mb))
+        dso_cache.store(mb, new_shared_file(mb, as_needed));
       return;
     case FileType::AR:
-      for (MemoryMappedFile *child : read_fat_archive_members(mb))
-        obj_cache.store(mb, new_object_file(child, mb->name));
+      watch_file(mb->name, mb->name);
+      if (!obj_cache.contains(mb))
+        for (MemoryMappedFile *child : read_fat_archive_members(mb))
+          obj_cache.store(mb, new_object_file(child, mb->name));
       return;
     case FileType::THIN_AR:
-      for (MemoryMappedFile *child : read_thin_archive_members(mb))
-        obj_cache.store(child, new_object_file(child, mb->name));
+      for (MemoryMappedFile *child : read_thin_archive_members(mb)) {
+        watch_file(child->name, mb->name);
+        if (!obj_cache.contains(child))
+          obj_cache.store(child, new_object_file(child, mb->name));
+      }
       return;
     case FileType::TEXT:
+      watch_file(mb->name, mb->name);
       parse_linker_script(mb, as_needed);
       return;
     }
     Fatal() << mb->name << ": unknown file type";
   }
 
-  switch (get_file_type(mb)) {
+  switch (type) {
   case FileType::OBJ:
-    if (ObjectFile *obj = obj_cache.get_one(mb))
+    if (ObjectFile *obj = obj_cache.get_one(mb)) {
+      obj->name = mb->name;
       out::objs.push_back(obj);
-    else
+      preloaded.inc();
+    } else {
       out::objs.push_back(new_object_file(mb, ""));
+    }
     return;
   case FileType::DSO:
-    if (SharedFile *obj = dso_cache.get_one(mb))
+    if (SharedFile *obj = dso_cache.get_one(mb)) {
+      obj->name = mb->name;
+      obj->is_alive = !as_needed;
       out::dsos.push_back(obj);
-    else
+      preloaded.inc();
+    } else {
       out::dsos.push_back(new_shared_file(mb, as_needed));
+    }
     return;
   case FileType::AR:
     if (std::vector<ObjectFile *> objs = obj_cache.get(mb); !objs.empty()) {
       append(out::objs, objs);
+      preloaded.inc(objs.size());
     } else {
-      for (MemoryMappedFile *child : read_archive_members(mb))
-        out::objs.push_back(new_object_file(child, mb->name));
+      std::vector<MemoryMappedFile *> children = read_archive_members(mb);
+      std::vector<std::vector<std::string_view>> syms = read_archive_symbols(mb);
+      for (int i = 0; i < children.size(); i++)
+        out::objs.push_back(new_archive_member(children[i], mb->name, syms, i));
     }
     return;
-  case FileType::THIN_AR:
-    for (MemoryMappedFile *child : read_thin_archive_members(mb)) {
-      if (ObjectFile *obj = obj_cache.get_one(child))
-        out::objs.push_back(obj);
-      else
-        out::objs.push_back(new_object_file(child, mb->name));
+  case FileType::THIN_AR: {
+    // Members are not even opened until they are needed, unless they
+    // have been preloaded.
+    std::vector<std::string> paths = read_thin_archive_paths(mb);
+    std::vector<std::vector<std::string_view>> syms = read_archive_symbols(mb);
+
+    for (int i = 0; i < paths.size(); i++) {
+      if (!obj_cache.empty()) {
+        MemoryMappedFile *child = MemoryMappedFile::open(paths[i]);
+        if (ObjectFile *obj = child ? obj_cache.get_one(child) : nullptr) {
+          out::objs.push_back(obj);
+          preloaded.inc();
+          continue;
+        }
+      }
+
+      MemoryMappedFile *child = MemoryMappedFile::open_deferred(paths[i]);
+      out::objs.push_back(new_archive_member(child, mb->name, syms, i));
     }
     return;
+  }
   case FileType::TEXT:
     parse_linker_script(mb, as_needed);
     return;
@@ -142,6 +294,10 @@ void read_file(MemoryMappedFile *mb, bool as_needed) {
   Fatal() << mb->name << ": unknown file type";
 }
 
+void read_file(MemoryMappedFile *mb, bool as_needed) {
+  read_file(mb, get_file_type(mb), as_needed);
+}
+
 template <typename T>
 static std::vector<std::span<T>> split(std::vector<T> &input, int unit) {
   assert(input.size() > 0);
@@ -163,6 +319,8 @@ static void resolve_symbols() {
   // Register defined symbols
   tbb::parallel_for_each(out::objs, [](ObjectFile *file) { file->resolve_symbols(); });
   tbb::parallel_for_each(out::dsos, [](SharedFile *file) { file->resolve_symbols(); });
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) { file->update_symbols(); });
+  tbb::parallel_for_each(out::dsos, [](SharedFile *file) { file->update_symbols(); });
 
   // Mark reachable objects and DSOs to decide which files to include
   // into an output.
@@ -174,15 +332,54 @@ static void resolve_symbols() {
   tbb::parallel_do(
     root,
     [&](ObjectFile *file, tbb::parallel_do_feeder<ObjectFile *> &feeder) {
+      if (file->is_lazy)
+        file->parse();
       for (ObjectFile *obj : file->mark_live_objects())
         feeder.add(obj);
     });
 
+  // Archive members that have been pulled out may have overridden
+  // symbols.
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    if (file->is_in_archive && file->is_alive)
+      file->update_symbols();
+  });
+
   // Eliminate unused archive members and as-needed DSOs.
+  static Counter skipped("skipped_members");
+  for (ObjectFile *file : out::objs)
+    if (file->is_lazy)
+      skipped.inc();
+
   erase(out::objs, [](InputFile *file) { return !file->is_alive; });
   erase(out::dsos, [](InputFile *file) { return !file->is_alive; });
 }
 
+// Mergeable sections are split into pieces when files are parsed, but
+// the pieces are interned only after we know which files are included
+// into an output, so that each string table can be sized for them
+// upfront. Table pages aren't touched until they are used, so
+// reserving for duplicate pieces doesn't cost much.
+static void intern_string_pieces() {
+  Timer t("intern_string_pieces");
+
+  std::vector<std::atomic_int64_t> num_pieces(MergedSection::instances.size());
+
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    for (MergeableSection *m : file->mergeable_sections)
+      if (m)
+        num_pieces[m->parent.idx] += m->piece_offsets.size();
+  });
+
+  tbb::parallel_for(0, (int)MergedSection::instances.size(), [&](int i) {
+    MergedSection::instances[i]->map.reserve(num_pieces[i]);
+  });
+
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    file->intern_string_pieces();
+  });
+}
+
 static void eliminate_comdats() {
   Timer t("comdat");
 
@@ -195,6 +392,92 @@ static void eliminate_comdats() {
   });
 }
 
+// Folds strings that are suffixes of other strings into them. For
+// example, "bar" doesn't need its own bytes if there's "foobar".
+// Folded strings are detached from their sections, and the returned
+// vector contains pairs of a folded string and a string containing it.
+static std::vector<std::pair<StringPiece *, StringPiece *>>
+tail_merge_strings() {
+  Timer t("tail_merge_strings");
+  static Counter counter("tail_merged_bytes");
+
+  std::vector<MergedSection *> &osecs = MergedSection::instances;
+  std::vector<std::vector<std::pair<StringPiece *, StringPiece *>>> vec(osecs.size());
+
+  tbb::parallel_for(0, (int)osecs.size(), [&](int i) {
+    if (!osecs[i]->is_string)
+      return;
+
+    std::vector<StringPiece *> pieces;
+    osecs[i]->map.for_each_value([&](const StringPiece &piece) {
+      if (piece.isec)
+        pieces.push_back((StringPiece *)&piece);
+    });
+
+    // Sort strings by their reversed contents, so that a string is
+    // immediately followed by strings that end with it.
+    tbb::parallel_sort(pieces.begin(), pieces.end(),
+                       [](StringPiece *a, StringPiece *b) {
+      for (i64 i = 1; i <= a->size && i <= b->size; i++) {
+        u8 x = a->data[a->size - i];
+        u8 y = b->data[b->size - i];
+        if (x != y)
+          return x < y;
+      }
+      return a->size < b->size;
+    });
+
+    // Wide strings can only be folded at character boundaries.
+    u32 entsize = osecs[i]->entsize;
+
+    auto is_suffix = [&](StringPiece *a, StringPiece *b) {
+      return a->size <= b->size && (b->size - a->size) % entsize == 0 &&
+             memcmp(a->data, b->data + b->size - a->size, a->size) == 0;
+    };
+
+    StringPiece *root = pieces.empty() ? nullptr : pieces.back();
+
+    for (i64 j = (i64)pieces.size() - 2; j >= 0; j--) {
+      if (is_suffix(pieces[j], pieces[j + 1])) {
+        vec[i].push_back({pieces[j], root});
+        pieces[j]->isec = nullptr;
+        counter.inc(pieces[j]->size);
+      } else {
+        root = pieces[j];
+      }
+    }
+  });
+
+  return flatten(vec);
+}
+
+// Creates a list of mergeable input sections for each merged output
+// section in the file order, in the same way as bin_sections.
+static void bin_mergeable_sections() {
+  int unit = (out::objs.size() + 127) / 128;
+  std::vector<std::span<ObjectFile *>> slices = split(out::objs, unit);
+
+  int num_osec = MergedSection::instances.size();
+
+  std::vector<std::vector<std::vector<MergeableSection *>>> groups(slices.size());
+  for (int i = 0; i < groups.size(); i++)
+    groups[i].resize(num_osec);
+
+  tbb::parallel_for(0, (int)slices.size(), [&](int i) {
+    for (ObjectFile *file : slices[i])
+      for (MergeableSection *m : file->mergeable_sections)
+        groups[i][m->parent.idx].push_back(m);
+  });
+
+  tbb::parallel_for(0, num_osec, [&](int j) {
+    std::vector<MergeableSection *> &members =
+      MergedSection::instances[j]->members;
+    members.clear();
+    for (int i = 0; i < groups.size(); i++)
+      append(members, groups[i][j]);
+  });
+}
+
 static void handle_mergeable_strings() {
   Timer t("resolve_strings");
 
@@ -210,6 +493,10 @@ static void handle_mergeable_strings() {
     }
   });
 
+  std::vector<std::pair<StringPiece *, StringPiece *>> folded;
+  if (config.optimize >= 2)
+    folded = tail_merge_strings();
+
   // Calculate the total bytes of mergeable strings for each input section.
   tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
     for (MergeableSection *m : file->mergeable_sections) {
@@ -224,13 +511,42 @@ static void handle_mergeable_strings() {
     }
   });
 
-  // Assign each mergeable input section a unique index.
-  for (ObjectFile *file : out::objs) {
-    for (MergeableSection *m : file->mergeable_sections) {
-      m->offset = m->parent.shdr.sh_size;
-      m->parent.shdr.sh_size += m->size;
-    }
-  }
+  bin_mergeable_sections();
+
+  tbb::parallel_for_each(MergedSection::instances, [](MergedSection *osec) {
+    std::vector<MergeableSection *> &members = osec->members;
+
+    // An output section is as aligned as its most aligned member, and
+    // pieces can be referred from any member. So we align all members
+    // to that.
+    u64 align = osec->shdr.sh_addralign;
+    for (MergeableSection *m : members)
+      align = std::max<u64>(align, m->shdr.sh_addralign);
+    osec->shdr.sh_addralign = align;
+
+    // Assign offsets to members with a parallel prefix sum.
+    tbb::parallel_scan(
+      tbb::blocked_range<i64>(0, members.size()), (u64)0,
+      [&](const tbb::blocked_range<i64> &r, u64 sum, bool is_final) {
+        for (i64 i = r.begin(); i < r.end(); i++) {
+          if (is_final)
+            members[i]->offset = sum;
+          sum += align_to(members[i]->size, align);
+        }
+        return sum;
+      },
+      std::plus<u64>());
+
+    if (!members.empty())
+      osec->shdr.sh_size = members.back()->offset + members.back()->size;
+  });
+
+  // Point folded strings to the tails of strings containing them.
+  tbb::parallel_for_each(folded, [](std::pair<StringPiece *, StringPiece *> &p) {
+    auto [piece, root] = p;
+    piece->isec = root->isec.load();
+    piece->output_offset = root->output_offset + root->size - piece->size;
+  });
 }
 
 // So far, each input section has a pointer to its corresponding
@@ -306,10 +622,10 @@ static void set_isec_offsets() {
       u64 off = 0;
       u32 align = 1;
 
-      for (InputChunk *isec : slices[i]) {
+      for (InputSection *isec : slices[i]) {
         off = align_to(off, isec->shdr.sh_addralign);
         isec->offset = off;
-        off += isec->shdr.sh_size;
+        off += std::max<u64>(isec->shdr.sh_size, isec->reserved_size);
         align = std::max<u32>(align, isec->shdr.sh_addralign);
       }
 
@@ -341,6 +657,7 @@ static void scan_rels() {
     for (InputSection *isec : file->sections)
       if (isec)
         isec->scan_relocations();
+    file->scan_ehframe_relocations();
   });
 
   // Exit if there was a relocation that refers an undefined symbol.
@@ -487,14 +804,14 @@ static void fill_symbol_versions() {
   };
 
   add_verneed(syms[0]);
-  out::versym->contents[syms[0]->dynsym_idx] = version;
+  out::versym->contents[syms[0]->aux().dynsym_idx] = version;
 
   for (int i = 1; i < syms.size(); i++) {
     if (syms[i - 1]->file != syms[i]->file)
       add_verneed(syms[i]);
     else if (syms[i - 1]->ver_idx != syms[i]->ver_idx)
       add_aux(syms[i]);
-    out::versym->contents[syms[i]->dynsym_idx] = version;
+    out::versym->contents[syms[i]->aux().dynsym_idx] = version;
   }
 }
 
@@ -567,6 +884,50 @@ static u64 set_osec_offsets(std::span<OutputChunk *> chunks) {
   return fileoff;
 }
 
+// Replace .debug_* sections with compressed ones. Since we need to
+// know the compressed sizes to fix the file layout, we render the
+// sections to a temporary buffer and compress them before creating
+// the output file. Non-alloc sections come after all alloc sections,
+// so this doesn't change any symbol address.
+static void compress_debug_sections() {
+  std::vector<OutputChunk *> chunks;
+  for (OutputChunk *chunk : out::chunks)
+    if (!(chunk->shdr.sh_flags & SHF_ALLOC) && chunk->name.starts_with(".debug"))
+      chunks.push_back(chunk);
+
+  if (chunks.empty())
+    return;
+
+  u64 begin = chunks.front()->shdr.sh_offset;
+  u64 end = chunks.back()->shdr.sh_offset + chunks.back()->shdr.sh_size;
+
+  std::string size_str = std::to_string((end - begin) / 1024 / 1024);
+  Timer t("compress_debug_sections (" + size_str + " MiB)");
+
+  // Copy the sections to a temporary buffer.
+  std::vector<u8> buf(end - begin);
+  out::buf = buf.data() - begin;
+
+  tbb::parallel_for_each(chunks, [&](OutputChunk *chunk) {
+    chunk->copy_buf();
+  });
+  Error::checkpoint();
+  out::buf = nullptr;
+
+  // Compress them.
+  std::vector<CompressedSection *> compressed(chunks.size());
+
+  tbb::parallel_for(0, (int)chunks.size(), [&](int i) {
+    ElfShdr &shdr = chunks[i]->shdr;
+    std::span<u8> contents(buf.data() + shdr.sh_offset - begin, shdr.sh_size);
+    compressed[i] = new CompressedSection(*chunks[i], contents);
+  });
+
+  for (int i = 0, j = 0; i < out::chunks.size(); i++)
+    if (j < chunks.size() && out::chunks[i] == chunks[j])
+      out::chunks[i] = compressed[j++];
+}
+
 static void fix_synthetic_symbols(std::span<OutputChunk *> chunks) {
   auto start = [](Symbol *sym, OutputChunk *chunk) {
     if (sym) {
@@ -661,16 +1022,58 @@ static void signal_handler(int) {
   _exit(1);
 }
 
+// Returns true if a directory may have a given file. Library
+// directories are listed only once, so that searching for libraries
+// doesn't stat each combination of directories and library names.
+//
+// The preload daemon doesn't use the cache, because libraries may be
+// created after the daemon starts, and the daemon's children would
+// inherit stale listings. A directory that can't be listed may still
+// be searchable, so we let the caller try to open the file in that case.
+static bool dir_contains(const std::string &dir, const std::string &name) {
+  static std::mutex mu;
+  static std::unordered_map<std::string, std::unordered_set<std::string> *> cache;
+
+  if (preloading)
+    return true;
+
+  std::unordered_set<std::string> *files;
+  {
+    std::lock_guard lock(mu);
+    files = cache[dir];
+  }
+
+  if (!files) {
+    DIR *dp = opendir(dir.c_str());
+    if (!dp)
+      return true;
+
+    files = new std::unordered_set<std::string>;
+    while (dirent *ent = readdir(dp))
+      files->insert(ent->d_name);
+    closedir(dp);
+
+    std::lock_guard lock(mu);
+    if (cache[dir])
+      delete std::exchange(files, cache[dir]);
+    else
+      cache[dir] = files;
+  }
+  return files->contains(name);
+}
+
 MemoryMappedFile *find_library(std::string name,
                                std::span<std::string_view> lib_paths) {
   for (std::string_view dir : lib_paths) {
     std::string root = dir.starts_with("/") ? config.sysroot : "";
-    std::string stem = root + std::string(dir) + "/lib" + name;
-    if (!config.is_static)
-      if (MemoryMappedFile *mb = MemoryMappedFile::open(stem + ".so"))
+    std::string path = root + std::string(dir);
+
+    if (!config.is_static && dir_contains(path, "lib" + name + ".so"))
+      if (MemoryMappedFile *mb = MemoryMappedFile::open(path + "/lib" + name + ".so"))
+        return mb;
+    if (dir_contains(path, "lib" + name + ".a"))
+      if (MemoryMappedFile *mb = MemoryMappedFile::open(path + "/lib" + name + ".a"))
         return mb;
-    if (MemoryMappedFile *mb = MemoryMappedFile::open(stem + ".a"))
-      return mb;
   }
   Fatal() << "library not found: " << name;
 }
@@ -816,7 +1219,8 @@ static std::vector<std::string_view> get_input_files(std::span<std::string_view>
   static std::unordered_set<std::string_view> needs_arg({
     "o", "dynamic-linker", "export-dynamic", "e", "entry", "y",
     "trace-symbol", "filler", "sysroot", "thread-count", "z",
-    "hash-style", "m", "rpath", "version-script",
+    "hash-style", "m", "rpath", "version-script", "icf",
+    "compress-debug-sections", "daemon-timeout", "O", "input-io",
   });
 
   std::vector<std::string_view> vec;
@@ -867,6 +1271,10 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.dynamic_linker = arg;
     } else if (read_flag(args, "export-dynamic")) {
       conf.export_dynamic = true;
+    } else if (read_flag(args, "eh-frame-hdr")) {
+      conf.eh_frame_hdr = true;
+    } else if (read_flag(args, "no-eh-frame-hdr")) {
+      conf.eh_frame_hdr = false;
     } else if (read_arg(args, arg, "e") || read_arg(args, arg, "entry")) {
       conf.entry = arg;
     } else if (read_flag(args, "print-map")) {
@@ -901,6 +1309,10 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.fork = false;
     } else if (read_arg(args, arg, "thread-count")) {
       conf.thread_count = parse_number("thread-count", arg);
+    } else if (read_arg(args, arg, "daemon-timeout")) {
+      conf.daemon_timeout = parse_number("daemon-timeout", arg);
+    } else if (read_arg(args, arg, "O")) {
+      conf.optimize = parse_number("O", arg);
     } else if (read_flag(args, "discard-all") || read_flag(args, "x")) {
       conf.discard_all = true;
     } else if (read_flag(args, "discard-locals") || read_flag(args, "X")) {
@@ -917,12 +1329,57 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
       conf.build_id = true;
     } else if (read_flag(args, "build-id=none")) {
       conf.build_id = false;
+    } else if (read_flag(args, "gc-sections")) {
+      conf.gc_sections = true;
+    } else if (read_flag(args, "no-gc-sections")) {
+      conf.gc_sections = false;
+    } else if (read_arg(args, arg, "icf")) {
+      if (arg == "all") {
+        conf.icf = true;
+        conf.icf_all = true;
+      } else if (arg == "safe") {
+        conf.icf = true;
+        conf.icf_all = false;
+      } else if (arg == "none") {
+        conf.icf = false;
+      } else {
+        Fatal() << "unknown --icf argument: " << arg;
+      }
+    } else if (read_arg(args, arg, "compress-debug-sections")) {
+      if (arg == "zlib" || arg == "zlib-gabi")
+        conf.compress_debug_sections = true;
+      else if (arg == "none")
+        conf.compress_debug_sections = false;
+      else
+        Fatal() << "unknown --compress-debug-sections argument: " << arg;
+    } else if (read_arg(args, arg, "input-io")) {
+      if (arg == "io_uring")
+        conf.input_io_uring = true;
+      else if (arg == "mmap")
+        conf.input_io_uring = false;
+      else
+        Fatal() << "unknown --input-io argument: " << arg;
+    } else if (read_flag(args, "incremental")) {
+      conf.incremental = true;
+    } else if (read_flag(args, "no-incremental")) {
+      conf.incremental = false;
     } else if (read_flag(args, "preload")) {
       conf.preload = true;
     } else if (read_arg(args, arg, "z")) {
     } else if (read_arg(args, arg, "hash-style")) {
+      if (arg == "sysv") {
+        conf.hash_style_sysv = true;
+        conf.hash_style_gnu = false;
+      } else if (arg == "gnu") {
+        conf.hash_style_sysv = false;
+        conf.hash_style_gnu = true;
+      } else if (arg == "both") {
+        conf.hash_style_sysv = true;
+        conf.hash_style_gnu = true;
+      } else {
+        Fatal() << "unknown --hash-style argument: " << arg;
+      }
     } else if (read_arg(args, arg, "m")) {
-    } else if (read_flag(args, "eh-frame-hdr")) {
     } else if (read_flag(args, "start-group")) {
     } else if (read_flag(args, "end-group")) {
     } else if (read_flag(args, "fatal-warnings")) {
@@ -945,6 +1402,15 @@ static Config parse_nonpositional_args(std::span<std::string_view> args,
 }
 
 static void read_input_files(std::span<std::string_view> args) {
+  struct Input {
+    std::string_view path;
+    std::string_view lib;
+    bool as_needed;
+    MemoryMappedFile *mb = nullptr;
+    FileType type;
+  };
+
+  std::vector<Input> inputs;
   bool as_needed = false;
 
   while (!args.empty()) {
@@ -955,13 +1421,67 @@ static void read_input_files(std::span<std::string_view> args) {
     } else if (read_flag(args, "no-as-needed")) {
       as_needed = false;
     } else if (read_arg(args, arg, "l")) {
-      read_file(find_library(std::string(arg), config.library_paths), as_needed);
+      inputs.push_back({"", arg, as_needed});
     } else {
-      read_file(MemoryMappedFile::must_open(std::string(args[0])), as_needed);
+      inputs.push_back({args[0], "", as_needed});
       args = args.subspan(1);
     }
   }
-  parser_tg.wait();
+
+  // Search libraries, open files and read their file types in
+  // parallel. Files are then read in the command line order.
+  std::vector<std::function<void()>> tasks;
+  for (Input &in : inputs) {
+    tasks.push_back([&]() {
+      if (in.lib.empty())
+        in.mb = MemoryMappedFile::must_open(std::string(in.path));
+      else
+        in.mb = find_library(std::string(in.lib), config.library_paths);
+      in.type = get_file_type(in.mb);
+    });
+  }
+  run_tasks(tasks);
+
+  for (Input &in : inputs)
+    read_file(in.mb, in.type, in.as_needed);
+
+  // Read input files ahead in background while they are being parsed.
+  // The preload daemon reads files into memory, so it doesn't need this.
+  std::thread prefetcher;
+  if (!preloading)
+    prefetcher = std::thread([files = std::move(input_files)]() {
+      for (MemoryMappedFile *mb : files)
+        mb->prefetch();
+    });
+
+  wait_for_parsers();
+
+  if (prefetcher.joinable())
+    prefetcher.join();
+  input_files.clear();
+}
+
+// Parses input files of a given command line in the preload daemon.
+static void preload_input_files(char **argv) {
+  std::vector<std::string_view> args = expand_response_files(argv + 1);
+  std::vector<std::string_view> file_args;
+  config = parse_nonpositional_args(args, file_args);
+
+  preloading = true;
+  read_input_files(file_args);
+  preloading = false;
+}
+
+// Re-parses files that have been modified since they were preloaded.
+// The daemon calls this between link requests, so that the next
+// request can use up-to-date files.
+static void reload_input_files(std::span<std::string> paths) {
+  preloading = true;
+  for (std::string &path : paths)
+    if (MemoryMappedFile *mb = MemoryMappedFile::open(path))
+      read_file(mb, false);
+  wait_for_parsers();
+  preloading = false;
 }
 
 static void show_stats() {
@@ -985,6 +1505,11 @@ static void show_stats() {
   Counter num_objs("num_objs", out::objs.size());
   Counter num_dsos("num_dsos", out::dsos.size());
 
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  Counter minor_faults("minor_faults", ru.ru_minflt);
+  Counter major_faults("major_faults", ru.ru_majflt);
+
   Counter::print();
 }
 
@@ -1010,11 +1535,13 @@ int main(int argc, char **argv) {
   std::function<void()> on_complete;
 
   if (config.preload) {
-    std::function<void()> wait_for_client;
-    daemonize(argv, &wait_for_client, &on_complete);
-    preloading = true;
-    read_input_files(file_args);
-    wait_for_client();
+    // daemonize() returns only in a child process that handles
+    // a link request, with the client's command line arguments.
+    argv = daemonize(argv, preload_input_files, reload_input_files,
+                     &on_complete);
+    arg_vector = expand_response_files(argv + 1);
+    file_args.clear();
+    config = parse_nonpositional_args(arg_vector, file_args);
   } else if (config.fork) {
     on_complete = fork_child();
   }
@@ -1036,7 +1563,6 @@ int main(int argc, char **argv) {
   // Parse input files
   {
     Timer t("parse");
-    preloading = false;
     read_input_files(file_args);
   }
 
@@ -1066,6 +1592,9 @@ int main(int argc, char **argv) {
   out::dynsym = new DynsymSection;
   out::dynstr = new DynstrSection;
   out::copyrel = new CopyrelSection;
+  out::eh_frame = new EhFrameSection;
+  if (config.eh_frame_hdr)
+    out::eh_frame_hdr = new EhFrameHdrSection;
   if (config.build_id)
     out::buildid = new BuildIdSection;
 
@@ -1073,7 +1602,10 @@ int main(int argc, char **argv) {
     out::interp = new InterpSection;
     out::dynamic = new DynamicSection;
     out::reldyn = new RelDynSection;
-    out::hash = new HashSection;
+    if (config.hash_style_sysv)
+      out::hash = new HashSection;
+    if (config.hash_style_gnu)
+      out::gnu_hash = new GnuHashSection;
     out::versym = new VersymSection;
     out::verneed = new VerneedSection;
   }
@@ -1090,10 +1622,13 @@ int main(int argc, char **argv) {
   out::chunks.push_back(out::symtab);
   out::chunks.push_back(out::strtab);
   out::chunks.push_back(out::hash);
+  out::chunks.push_back(out::gnu_hash);
   out::chunks.push_back(out::copyrel);
   out::chunks.push_back(out::versym);
   out::chunks.push_back(out::verneed);
   out::chunks.push_back(out::buildid);
+  out::chunks.push_back(out::eh_frame);
+  out::chunks.push_back(out::eh_frame_hdr);
 
   // Set priorities to files. File priority 1 is reserved for the internal file.
   int priority = 2;
@@ -1110,6 +1645,9 @@ int main(int argc, char **argv) {
   // included to the final output.
   resolve_symbols();
 
+  // Put mergeable strings to string tables.
+  intern_string_pieces();
+
   if (config.trace) {
     for (ObjectFile *file : out::objs)
       SyncOut() << *file;
@@ -1120,6 +1658,14 @@ int main(int argc, char **argv) {
   // Remove redundant comdat sections (e.g. duplicate inline functions).
   eliminate_comdats();
 
+  // Garbage-collect unreachable sections.
+  if (config.gc_sections)
+    gc_sections();
+
+  // Merge identical sections.
+  if (config.icf)
+    icf_sections();
+
   // Merge strings constants in SHF_MERGE sections.
   handle_mergeable_strings();
 
@@ -1134,6 +1680,13 @@ int main(int argc, char **argv) {
   // Bin input sections into output sections
   bin_sections();
 
+  // Deduplicate CIEs and remove FDEs for dead sections.
+  out::eh_frame->construct();
+
+  // Reserve space after input sections for incremental linking.
+  if (config.incremental)
+    load_incremental_state(arg_vector);
+
   // Assign offsets within an output section to input sections.
   set_isec_offsets();
 
@@ -1167,6 +1720,7 @@ int main(int argc, char **argv) {
   // (e.g. `__bss_start`).
   out::internal_file = new ObjectFile;
   out::internal_file->resolve_symbols();
+  out::internal_file->update_symbols();
   out::objs.push_back(out::internal_file);
 
   // Convert weak symbols to absolute symbols with value 0.
@@ -1175,6 +1729,9 @@ int main(int argc, char **argv) {
     tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
       file->handle_undefined_weak_symbols();
     });
+    tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+      file->update_undefined_weak_symbols();
+    });
   }
 
   // Beyond this point, no new symbols will be added to the result.
@@ -1250,30 +1807,43 @@ int main(int argc, char **argv) {
     }
   }
 
-  t_before_copy.stop();
+  // Compress debug sections and fix the file layout again.
+  if (config.compress_debug_sections) {
+    compress_debug_sections();
+    filesize = set_osec_offsets(out::chunks);
+  }
 
-  // Create an output file
-  OutputFile *file = OutputFile::open(config.output, filesize);
-  out::buf = file->buf;
+  t_before_copy.stop();
 
   Timer t_copy("copy");
 
-  // Copy input sections to the output file
-  {
-    Timer t("copy_buf");
-    tbb::parallel_for_each(out::chunks, [&](OutputChunk *chunk) {
-      chunk->copy_buf();
-    });
-    Error::checkpoint();
-  }
+  // If the file layout hasn't changed since the last link, patch the
+  // existing output file in place. Otherwise, write the whole file.
+  if (!config.incremental || !incremental_link(filesize)) {
+    // Create an output file
+    OutputFile *file = OutputFile::open(config.output, filesize);
+    out::buf = file->buf;
+
+    // Copy input sections to the output file
+    {
+      Timer t("copy_buf");
+      tbb::parallel_for_each(out::chunks, [&](OutputChunk *chunk) {
+        chunk->copy_buf();
+      });
+      Error::checkpoint();
+    }
 
-  // Zero-clear paddings between sections
-  clear_padding(filesize);
+    // Zero-clear paddings between sections
+    clear_padding(filesize);
 
-  // Commit
-  if (out::buildid)
-    out::buildid->write_buildid(filesize);
-  file->close();
+    // Commit
+    if (out::buildid)
+      out::buildid->write_buildid(filesize);
+    file->close();
+
+    if (config.incremental)
+      save_incremental_state();
+  }
 
   t_copy.stop();
   t_total.stop();
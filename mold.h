@@ -7,8 +7,10 @@
 #include "elf.h"
 
 #include <atomic>
+#include <bit>
 #include <cassert>
 #include <cstdint>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <mutex>
@@ -16,8 +18,6 @@
 #include <sstream>
 #include <string>
 #include <string_view>
-#include <tbb/concurrent_hash_map.h>
-#include <tbb/spin_mutex.h>
 #include <vector>
 
 #define SECTOR_SIZE 512
@@ -53,10 +53,19 @@ struct Config {
   std::string output;
   std::string rpaths;
   bool build_id = false;
+  bool compress_debug_sections = false;
   bool discard_all = false;
   bool discard_locals = false;
   bool export_dynamic = false;
   bool fork = true;
+  bool eh_frame_hdr = false;
+  bool gc_sections = false;
+  bool hash_style_gnu = false;
+  bool hash_style_sysv = true;
+  bool icf = false;
+  bool icf_all = false;
+  bool incremental = false;
+  bool input_io_uring = false;
   bool is_static = false;
   bool perf = false;
   bool pie = false;
@@ -69,6 +78,8 @@ struct Config {
   bool z_now = false;
   int filler = -1;
   int thread_count = -1;
+  int daemon_timeout = 30;
+  int optimize = 0;
   std::string sysroot;
   std::vector<std::string> globals;
   std::vector<std::string_view> library_paths;
@@ -150,41 +161,250 @@ std::ostream &operator<<(std::ostream &out, const InputFile &file);
 // Interned string
 //
 
-namespace tbb {
-template<>
-struct tbb_hash_compare<std::string_view> {
-  static size_t hash(const std::string_view& k) {
-    return std::hash<std::string_view>()(k);
+// A fast non-cryptographic hash function for strings, based on
+// wyhash. It reads input eight bytes at a time and mixes them with
+// 64x64->128 bit multiplications, which is much faster than
+// std::hash for symbol names, which tend to be long.
+inline u64 hash_string(std::string_view str) {
+  static constexpr u64 P0 = 0xa0761d6478bd642f;
+  static constexpr u64 P1 = 0xe7037ed1a0b428db;
+
+  auto mix = [](u64 a, u64 b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (u64)r ^ (u64)(r >> 64);
+  };
+
+  auto read8 = [](const u8 *p) { u64 v; memcpy(&v, p, 8); return v; };
+  auto read4 = [](const u8 *p) { u32 v; memcpy(&v, p, 4); return (u64)v; };
+
+  const u8 *p = (const u8 *)str.data();
+  u64 len = str.size();
+  u64 seed = mix(P0, P1);
+  u64 a, b;
+
+  if (len <= 16) {
+    if (len >= 4) {
+      a = (read4(p) << 32) | read4(p + ((len >> 3) << 2));
+      b = (read4(p + len - 4) << 32) | read4(p + len - 4 - ((len >> 3) << 2));
+    } else if (len > 0) {
+      a = ((u64)p[0] << 16) | ((u64)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    u64 i = len;
+    while (i > 16) {
+      seed = mix(read8(p) ^ P1, read8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = read8(p + i - 16);
+    b = read8(p + i - 8);
   }
 
-  static bool equal(const std::string_view& k1, const std::string_view& k2) {
-    return k1 == k2;
-  }
-};
+  __uint128_t r = (__uint128_t)(a ^ P1) * (b ^ seed);
+  return mix((u64)r ^ P0 ^ len, (u64)(r >> 64) ^ P1);
 }
 
+// A lock-free hash table for interning strings. Keys are not copied,
+// so they must outlive the table. Values are stored in place and never
+// move, so pointers to them remain valid.
+//
+// The table uses open addressing with linear probing. A new key claims
+// an empty slot with CAS. If a key doesn't find its slot within
+// MAX_PROBE slots, it goes to an overflow table, which is allocated on
+// demand. Slots are never freed, so threads inserting the same key
+// always visit the same slots and agree on where the key lives.
+//
+// Slots hold only an index into a dense array of values, so that empty
+// slots cost a few bytes rather than a whole value, and values are
+// packed together in insertion order. The value array consists of
+// segments whose sizes double, so it grows without moving values.
+//
+// Overflow tables are never larger than the tables they spill from,
+// so a map that isn't pre-sized with reserve() grows only linearly.
+// Every map should be reserved for the number of keys it is expected
+// to hold, so that overflow tables are rarely needed.
 template<typename ValueT>
 class ConcurrentMap {
 public:
-  typedef tbb::concurrent_hash_map<std::string_view, ValueT> MapT;
+  ConcurrentMap() : root(new Table(MIN_BUCKETS)) {}
+
+  // Makes room for a given number of keys. This function must not be
+  // called concurrently with insert().
+  void reserve(i64 nkeys) {
+    i64 nexisting = size();
+    i64 nbuckets = MIN_BUCKETS;
+    while (nbuckets < (nexisting + nkeys) * 2)
+      nbuckets *= 2;
+
+    if (nexisting == 0 && !root->next) {
+      if (root->nbuckets < nbuckets) {
+        delete root;
+        root = new Table(nbuckets);
+      }
+      return;
+    }
+
+    // Existing slots can't be moved, so add an overflow table.
+    Table *last = root;
+    i64 capacity = root->nbuckets;
+    for (; last->next; last = last->next)
+      capacity += last->next.load()->nbuckets;
+
+    if (capacity < nbuckets)
+      last->next = new Table(nbuckets);
+  }
 
   ValueT *insert(std::string_view key, const ValueT &val) {
-    typename MapT::const_accessor acc;
-    map.insert(acc, std::make_pair(key, val));
-    return const_cast<ValueT *>(&acc->second);
+    return insert(key, hash_string(key), val);
+  }
+
+  // `hash` must be hash_string(key).
+  ValueT *insert(std::string_view key, u64 hash, const ValueT &val) {
+    for (Table *table = root;;) {
+      if (ValueT *ret = table->insert(*this, key, hash, val))
+        return ret;
+
+      Table *next = table->next.load(std::memory_order_acquire);
+      if (!next) {
+        Table *tmp = new Table(std::min(table->nbuckets, MAX_OVERFLOW_BUCKETS));
+        if (table->next.compare_exchange_strong(next, tmp))
+          next = tmp;
+        else
+          delete tmp;
+      }
+      table = next;
+    }
+  }
+
+  // Hints the CPU to load the first slot for a given hash. Callers
+  // inserting many keys can call this for a batch of keys before
+  // inserting them to overlap cache misses. Only the root table is
+  // prefetched, so the map should be reserved for the expected number
+  // of keys to make this effective.
+  void prefetch(u64 hash) {
+    i64 idx = hash & (root->nbuckets - 1);
+    __builtin_prefetch(root->keys + idx, 1);
+    __builtin_prefetch(root->sizes + idx);
+    __builtin_prefetch(root->tags + idx);
+  }
+
+  // Values are numbered from 0 in insertion order. for_each_value()
+  // and size() must not be called concurrently with insert().
+  ValueT &operator[](i64 idx) {
+    i64 seg = get_segment(idx);
+    return segments[seg][idx - get_segment_begin(seg)];
   }
 
   void for_each_value(std::function<void(const ValueT &)> fn) {
-    for (typename MapT::const_iterator it = map.begin(); it != map.end(); ++it)
-      fn(it->second);
+    for (i64 i = 0; i < size(); i++)
+      fn((*this)[i]);
   }
 
   size_t size() const {
-    return map.size();
+    return num_values;
   }
 
 private:
-  MapT map;
+  static constexpr i64 MIN_BUCKETS = 1024;
+  static constexpr i64 MAX_OVERFLOW_BUCKETS = 1024 * 1024;
+  static constexpr i64 MAX_PROBE = 16;
+  static constexpr i64 SEGMENT_SIZE = 1024;
+  static constexpr i64 MAX_SEGMENTS = 32;
+
+  // Segment n has SEGMENT_SIZE << n values.
+  static i64 get_segment(i64 idx) {
+    return std::bit_width((u64)idx / SEGMENT_SIZE + 1) - 1;
+  }
+
+  static i64 get_segment_begin(i64 seg) {
+    return SEGMENT_SIZE * ((1LL << seg) - 1);
+  }
+
+  // Allocates a value and returns its index.
+  u32 add_value(const ValueT &val) {
+    i64 idx = num_values++;
+    i64 seg = get_segment(idx);
+    if (seg >= MAX_SEGMENTS)
+      Fatal() << "too many keys in a hash table";
+
+    ValueT *vec = segments[seg].load(std::memory_order_acquire);
+    if (!vec) {
+      ValueT *tmp = (ValueT *)malloc((SEGMENT_SIZE << seg) * sizeof(ValueT));
+      if (!tmp)
+        Fatal() << "out of memory: cannot allocate " << (SEGMENT_SIZE << seg)
+                << " hash table values";
+      if (segments[seg].compare_exchange_strong(vec, tmp))
+        vec = tmp;
+      else
+        free(tmp);
+    }
+
+    new (vec + idx - get_segment_begin(seg)) ValueT(val);
+    return idx;
+  }
+
+  struct Table {
+    Table(i64 nbuckets) : nbuckets(nbuckets) {
+      // calloc'ed pages are not touched until used, so a large
+      // table doesn't cost much if it is sparsely populated.
+      keys = (std::atomic<const char *> *)calloc(nbuckets, sizeof(keys[0]));
+      sizes = (u32 *)malloc(nbuckets * sizeof(sizes[0]));
+      tags = (u32 *)malloc(nbuckets * sizeof(tags[0]));
+      indices = (u32 *)malloc(nbuckets * sizeof(indices[0]));
+
+      if (!keys || !sizes || !tags || !indices)
+        Fatal() << "out of memory: cannot allocate a hash table of "
+                << nbuckets << " buckets";
+    }
+
+    ~Table() {
+      free(keys);
+      free(sizes);
+      free(tags);
+      free(indices);
+    }
+
+    ValueT *insert(ConcurrentMap &map, std::string_view key, u64 hash,
+                   const ValueT &val) {
+      for (i64 i = 0; i < MAX_PROBE; i++) {
+        i64 idx = (hash + i) & (nbuckets - 1);
+        const char *ptr = keys[idx].load(std::memory_order_acquire);
+
+        if (!ptr && keys[idx].compare_exchange_strong(ptr, LOCKED)) {
+          indices[idx] = map.add_value(val);
+          sizes[idx] = key.size();
+          tags[idx] = hash >> 32;
+          keys[idx].store(key.data(), std::memory_order_release);
+          return &map[indices[idx]];
+        }
+
+        // Some other thread is initializing the slot.
+        while (ptr == LOCKED)
+          ptr = keys[idx].load(std::memory_order_acquire);
+
+        if (tags[idx] == (u32)(hash >> 32) && sizes[idx] == key.size() &&
+            memcmp(ptr, key.data(), key.size()) == 0)
+          return &map[indices[idx]];
+      }
+      return nullptr;
+    }
+
+    std::atomic<const char *> *keys;
+    u32 *sizes;
+    u32 *tags;
+    u32 *indices;
+    i64 nbuckets;
+    std::atomic<Table *> next = nullptr;
+  };
+
+  static inline const char *LOCKED = (const char *)-1;
+
+  Table *root;
+  std::atomic<ValueT *> segments[MAX_SEGMENTS] = {};
+  std::atomic_int64_t num_values = 0;
 };
 
 //
@@ -222,16 +442,32 @@ enum {
   NEEDS_DYNSYM   = 1 << 6,
 };
 
+// Indices into output tables such as .got or .dynsym. Only a small
+// fraction of symbols need them, so they are stored in a separate
+// dense array rather than in every Symbol.
+struct SymbolAux {
+  u32 got_idx = -1;
+  u32 gotplt_idx = -1;
+  u32 gottpoff_idx = -1;
+  u32 tlsgd_idx = -1;
+  u32 plt_idx = -1;
+  u32 dynsym_idx = -1;
+};
+
 class Symbol {
 public:
   Symbol() {}
   Symbol(const Symbol &other) : name(other.name) {}
 
-  static Symbol *intern(std::string_view name) {
+  static ConcurrentMap<Symbol> &get_map() {
     static ConcurrentMap<Symbol> map;
+    return map;
+  }
+
+  static Symbol *intern(std::string_view name) {
     Symbol sym;
     sym.name = name;
-    return map.insert(name, sym);
+    return get_map().insert(name, sym);
   }
 
   inline u64 get_addr() const;
@@ -241,33 +477,33 @@ public:
   inline u64 get_tlsgd_addr() const;
   inline u64 get_plt_addr() const;
 
+  // Returns a SymbolAux. All fields are -1 if the symbol doesn't have
+  // one yet.
+  inline const SymbolAux &aux() const;
+
+  // Returns a SymbolAux, allocating one if the symbol doesn't have
+  // one yet. This function is not thread-safe.
+  inline SymbolAux &alloc_aux();
+
   bool is_absolute() const;
 
   bool is_relative() const {
     return !is_absolute();
   }
 
+  // Fields used by symbol resolution and liveness marking are packed
+  // at the beginning, so that these passes touch fewer cache lines.
   std::string_view name;
   InputFile *file = nullptr;
   const ElfSym *esym = nullptr;
-  InputSection *input_section = nullptr;
-  StringPieceRef piece_ref;
 
-  u64 value = -1;
-  u32 got_idx = -1;
-  u32 gotplt_idx = -1;
-  u32 gottpoff_idx = -1;
-  u32 tlsgd_idx = -1;
-  u32 plt_idx = -1;
-  u32 dynsym_idx = -1;
-  u16 shndx = 0;
-  u16 ver_idx = 0;
+  // The rank of the definition that currently owns this symbol. See
+  // get_rank() in object_file.cc. The default is "unclaimed".
+  std::atomic_uint64_t rank = (u64)4 << 32;
 
   std::atomic_uint8_t flags = 0;
   u8 st_type = STT_NOTYPE;
 
-  tbb::spin_mutex mu;
-
   u8 is_placeholder : 1 = false;
   u8 is_imported : 1 = false;
   u8 is_weak : 1 = false;
@@ -276,6 +512,14 @@ public:
   u8 traced : 1 = false;
   u8 has_relplt : 1 = false;
   u8 has_copyrel : 1 = false;
+
+  u32 aux_idx = -1;
+  u16 shndx = 0;
+  u16 ver_idx = 0;
+
+  InputSection *input_section = nullptr;
+  StringPieceRef piece_ref;
+  u64 value = -1;
 };
 
 //
@@ -325,6 +569,7 @@ public:
   void scan_relocations();
   void report_undefined_symbols();
 
+  std::string_view contents;
   std::span<ElfRela> rels;
   std::vector<bool> has_rel_piece;
   std::vector<StringPieceRef> rel_pieces;
@@ -332,20 +577,51 @@ public:
   u64 reldyn_offset = 0;
   bool is_comdat_member = false;
   bool is_alive = true;
+  std::atomic_bool is_visited = false;
+  std::atomic_bool is_address_taken = false;
+  InputSection *leader = nullptr;
+  i32 icf_idx = -1;
+  bool is_ehframe = false;
+
+  // FDEs for this section are ObjectFile::fdes[fde_begin:fde_end]
+  u32 fde_begin = 0;
+  u32 fde_end = 0;
+
+  // With --incremental, each section is given some extra space so that
+  // it can grow without changing the file layout in the next link.
+  u32 reserved_size = 0;
 
   void copy_contents(u8 *base);
   void apply_reloc_alloc(u8 *base);
   void apply_reloc_nonalloc(u8 *base);
 };
 
+// Returns true if a section contains pointers to initializers or
+// finalizers, which are not referenced by relocations.
+inline bool is_init_fini(const InputSection &isec) {
+  return isec.shdr.sh_type == SHT_INIT_ARRAY ||
+         isec.shdr.sh_type == SHT_FINI_ARRAY ||
+         isec.shdr.sh_type == SHT_PREINIT_ARRAY ||
+         isec.name.starts_with(".ctors") ||
+         isec.name.starts_with(".dtors") ||
+         isec.name.starts_with(".init") ||
+         isec.name.starts_with(".fini");
+}
+
 class MergeableSection : public InputChunk {
 public:
   MergeableSection(InputSection *isec, std::string_view contents);
+  void intern_pieces();
 
   MergedSection &parent;
+  std::string_view contents;
   std::vector<StringPiece *> pieces;
   std::vector<u32> piece_offsets;
   u32 size = 0;
+
+  // Hashes of pieces. They are computed when a section is split, and
+  // freed once the pieces are interned.
+  std::vector<u64> hashes;
 };
 
 //
@@ -626,41 +902,91 @@ private:
   static u32 hash(std::string_view name);
 };
 
+class GnuHashSection : public OutputChunk {
+public:
+  GnuHashSection() : OutputChunk(SYNTHETIC) {
+    name = ".gnu.hash";
+    shdr.sh_type = SHT_GNU_HASH;
+    shdr.sh_flags = SHF_ALLOC;
+    shdr.sh_addralign = 8;
+  }
+
+  void update_shdr() override;
+  void copy_buf() override;
+
+  static constexpr int LOAD_FACTOR = 8;
+  static constexpr int HEADER_SIZE = 16;
+  static constexpr int BLOOM_SHIFT = 26;
+  static constexpr int ELFCLASS_BITS = 64;
+
+  u32 num_buckets = -1;
+  u32 num_bloom = 1;
+  u32 symoffset = -1;
+
+  // GNU hash values of exported dynamic symbols in .dynsym order
+  std::vector<u32> hashes;
+};
+
 class MergedSection : public OutputChunk {
 public:
-  static MergedSection *get_instance(std::string_view name, u32 type, u64 flags);
+  static MergedSection *get_instance(std::string_view name, u32 type,
+                                     u64 flags, u32 entsize);
 
   static inline std::vector<MergedSection *> instances;
   ConcurrentMap<StringPiece> map;
 
+  // Pieces are NUL-terminated strings of entsize-byte characters if
+  // SHF_STRINGS is set in input sections, or entsize-byte records
+  // otherwise.
+  u32 entsize;
+  bool is_string;
+
+  std::vector<MergeableSection *> members;
+  u32 idx;
+
   void copy_buf() override;
 
 private:
-  MergedSection(std::string_view name, u64 flags, u32 type)
-    : OutputChunk(SYNTHETIC) {
+  MergedSection(std::string_view name, u64 flags, u32 type, u32 entsize,
+                bool is_string)
+    : OutputChunk(SYNTHETIC), entsize(entsize), is_string(is_string) {
     this->name = name;
     shdr.sh_flags = flags;
     shdr.sh_type = type;
     shdr.sh_addralign = 1;
+    idx = instances.size();
+    instances.push_back(this);
   }
 };
 
 class EhFrameSection : public OutputChunk {
 public:
-  EhFrameSection(OutputSection *original)
-    : OutputChunk(SYNTHETIC), members(std::move(original->members)) {
+  EhFrameSection() : OutputChunk(SYNTHETIC) {
     name = ".eh_frame";
     shdr.sh_type = SHT_PROGBITS;
     shdr.sh_flags = SHF_ALLOC;
+    shdr.sh_addralign = 8;
+  }
+
+  void construct();
+  void copy_buf() override;
+
+  u32 num_fdes = 0;
+};
+
+class EhFrameHdrSection : public OutputChunk {
+public:
+  EhFrameHdrSection() : OutputChunk(SYNTHETIC) {
+    name = ".eh_frame_hdr";
+    shdr.sh_type = SHT_PROGBITS;
+    shdr.sh_flags = SHF_ALLOC;
     shdr.sh_addralign = 4;
   }
 
-  void finalize_contents();
+  void update_shdr() override;
   void copy_buf() override;
 
-private:
-  std::vector<InputSection *> members;
-  std::vector<std::vector<u8>> contents;
+  static constexpr int HEADER_SIZE = 12;
 };
 
 class CopyrelSection : public OutputChunk {
@@ -722,6 +1048,21 @@ public:
   void write_buildid(u64 filesize);
 };
 
+// A zlib-compressed copy of a non-alloc output section. Contents are
+// compressed in independent shards, which are then concatenated into
+// a single zlib stream.
+class CompressedSection : public OutputChunk {
+public:
+  CompressedSection(OutputChunk &chunk, std::span<u8> contents);
+  void copy_buf() override;
+
+private:
+  ElfChdr chdr = {};
+  std::vector<std::vector<u8>> shards;
+  std::vector<u64> shard_offsets;
+  u32 checksum = 0;
+};
+
 bool is_c_identifier(std::string_view name);
 std::vector<ElfPhdr> create_phdr();
 
@@ -735,14 +1076,43 @@ struct ComdatGroup {
   ComdatGroup(const ComdatGroup &other)
     : file(other.file.load()), section_idx(other.section_idx) {}
 
+  static ConcurrentMap<ComdatGroup> &get_map() {
+    static ConcurrentMap<ComdatGroup> map;
+    return map;
+  }
+
   std::atomic<ObjectFile *> file;
   u32 section_idx;
 };
 
+// .eh_frame sections consist of CIE and FDE records. We split them
+// into records so that we can deduplicate CIEs and drop FDEs that
+// belong to dead sections.
+struct CieRecord {
+  bool should_merge(const CieRecord &other) const;
+
+  ObjectFile *file;
+  std::string_view contents;
+  std::span<ElfRela> rels;
+  u32 input_offset;
+  u32 output_offset = -1;
+  CieRecord *leader = nullptr;
+};
+
+struct FdeRecord {
+  std::string_view contents;
+  std::span<ElfRela> rels;
+  u32 input_offset;
+  u32 output_offset = -1;
+  u32 cie_idx;
+  bool is_alive = true;
+};
+
 class MemoryMappedFile {
 public:
   static MemoryMappedFile *open(std::string path);
   static MemoryMappedFile *must_open(std::string path);
+  static MemoryMappedFile *open_deferred(std::string path);
 
   MemoryMappedFile(std::string name, u8 *data, u64 size, u64 mtime = 0)
     : name(name), data_(data), size_(size), mtime(mtime) {}
@@ -751,16 +1121,35 @@ public:
   MemoryMappedFile *slice(std::string name, u64 start, u64 size);
 
   u8 *data();
-  u64 size() { return size_; }
+  std::string_view peek(u64 size);
+  void prefetch();
+
+  u64 size() {
+    if (is_deferred)
+      data();
+    return size_;
+  }
 
   std::string name;
   u64 mtime = 0;
+  u64 dev = 0;
+  u64 ino = 0;
+
+  // The preload daemon keeps files for a long time, during which they
+  // may be overwritten in place. If true, file contents are copied to
+  // memory instead of being mmap'ed to protect them from such changes.
+  static inline bool read_into_memory = false;
 
 private:
   std::mutex mu;
   MemoryMappedFile *parent;
   std::atomic<u8 *> data_;
   u64 size_ = 0;
+  std::string head;
+
+  // If true, the file is not stat'ed until its contents are accessed.
+  bool is_deferred = false;
+  bool is_mmapped = false;
 };
 
 class InputFile {
@@ -777,8 +1166,11 @@ public:
   u32 priority;
   std::atomic_bool is_alive = false;
 
+  void read_header();
   std::string_view get_string(const ElfShdr &shdr);
   std::string_view get_string(u32 idx);
+  i64 count_defined_symbols();
+  i64 count_comdat_groups();
 
 protected:
   template<typename T> std::span<T> get_data(const ElfShdr &shdr);
@@ -794,14 +1186,20 @@ public:
   ObjectFile();
 
   void parse();
+  void read_lazy_symbols();
+  void read_lazy_symbols(std::span<std::string_view> names);
   void initialize_mergeable_sections();
+  void intern_string_pieces();
   void resolve_symbols();
+  void update_symbols();
   std::vector<ObjectFile *> mark_live_objects();
   void handle_undefined_weak_symbols();
+  void update_undefined_weak_symbols();
   void resolve_comdat_groups();
   void eliminate_duplicate_comdat_groups();
   void assign_mergeable_string_offsets();
   void convert_common_symbols();
+  void scan_ehframe_relocations();
   void compute_symtab();
   void write_symtab();
 
@@ -813,6 +1211,11 @@ public:
   int first_global = 0;
   const bool is_in_archive = false;
 
+  // An archive member is lazy until it is pulled out. A lazy file has
+  // only names of its defined global symbols and isn't parsed yet.
+  bool is_lazy = false;
+  std::vector<Symbol *> lazy_symbols;
+
   u64 num_dynrel = 0;
   u64 reldyn_offset = 0;
 
@@ -825,14 +1228,23 @@ public:
 
   std::vector<MergeableSection *> mergeable_sections;
 
+  std::vector<CieRecord> cies;
+  std::vector<FdeRecord> fdes;
+  u64 ehframe_offset = 0;
+  u64 ehframe_size = 0;
+  u32 fde_idx = 0;
+
 private:
   void initialize_sections();
   void initialize_symbols();
+  void initialize_ehframe_sections();
+  InputSection *read_compressed_section(const ElfShdr &shdr,
+                                        std::string_view name);
+  void read_ehframe(InputSection &isec);
   std::vector<StringPieceRef> read_string_pieces(InputSection *isec);
-  void maybe_override_symbol(Symbol &sym, int symidx);
+  u64 get_symbol_rank(int symidx);
 
   std::vector<std::pair<ComdatGroup *, std::span<u32>>> comdat_groups;
-  std::vector<StringPieceRef> sym_pieces;
   bool has_common_symbol;
 
   std::string_view symbol_strtab;
@@ -842,11 +1254,13 @@ private:
 class SharedFile : public InputFile {
 public:
   SharedFile(MemoryMappedFile *mb, bool as_needed) : InputFile(mb) {
+    is_dso = true;
     is_alive = !as_needed;
   }
 
   void parse();
   void resolve_symbols();
+  void update_symbols();
   std::span<Symbol *> find_aliases(Symbol *sym);
 
   std::string_view soname;
@@ -855,7 +1269,6 @@ public:
 
 private:
   std::string_view get_soname();
-  void maybe_override_symbol(Symbol &sym, const ElfSym &esym);
   std::vector<std::string_view> read_verdef();
 
   std::vector<const ElfSym *> elf_syms;
@@ -877,6 +1290,29 @@ inline std::ostream &operator<<(std::ostream &out, const InputChunk &isec) {
 std::vector<MemoryMappedFile *> read_archive_members(MemoryMappedFile *mb);
 std::vector<MemoryMappedFile *> read_fat_archive_members(MemoryMappedFile *mb);
 std::vector<MemoryMappedFile *> read_thin_archive_members(MemoryMappedFile *mb);
+std::vector<std::string> read_thin_archive_paths(MemoryMappedFile *mb);
+std::vector<std::vector<std::string_view>>
+read_archive_symbols(MemoryMappedFile *mb);
+
+//
+// gc_sections.cc
+//
+
+void gc_sections();
+
+//
+// icf.cc
+//
+
+void icf_sections();
+
+//
+// incremental.cc
+//
+
+void load_incremental_state(std::span<std::string_view> args);
+bool incremental_link(u64 filesize);
+void save_incremental_state();
 
 //
 // linker_script.cc
@@ -910,18 +1346,18 @@ protected:
 
 class Counter {
 public:
-  Counter(std::string_view name, u32 value = 0) : name(name), value(value) {
+  Counter(std::string_view name, u64 value = 0) : name(name), value(value) {
     static std::mutex mu;
     std::lock_guard lock(mu);
     instances.push_back(this);
   }
 
-  void inc(u32 delta = 1) {
+  void inc(u64 delta = 1) {
     if (enabled)
       value += delta;
   }
 
-  void set(u32 value) {
+  void set(u64 value) {
     this->value = value;
   }
 
@@ -931,7 +1367,7 @@ public:
 
 private:
   std::string_view name;
-  std::atomic_uint32_t value;
+  std::atomic_uint64_t value;
 
   static inline std::vector<Counter *> instances;
 };
@@ -960,6 +1396,62 @@ private:
   TimerRecord *record;
 };
 
+//
+// arena.cc
+//
+
+// A bump allocator for objects that are created during parsing and
+// live until the linker exits, such as input sections. Each thread
+// has its own arena, so allocations don't need any locks, and objects
+// are carved out of large slabs instead of being malloc'ed one by one.
+// Objects allocated from an arena are never freed.
+class Arena {
+public:
+  static Arena &get() {
+    thread_local Arena *arena = new Arena;
+    return *arena;
+  }
+
+  void *allocate(u64 size, u64 align) {
+    u8 *p = (u8 *)(((uintptr_t)cur + align - 1) & ~(uintptr_t)(align - 1));
+    if (p <= end && size <= (u64)(end - p)) {
+      cur = p + size;
+      return p;
+    }
+    return allocate_slow(size, align);
+  }
+
+  template<typename T, typename... Args>
+  static T *make(Args &&...args) {
+    void *p = get().allocate(sizeof(T), alignof(T));
+    return new (p) T(std::forward<Args>(args)...);
+  }
+
+  template<typename T>
+  static T *make_array(i64 n) {
+    T *p = (T *)get().allocate(sizeof(T) * n, alignof(T));
+    for (i64 i = 0; i < n; i++)
+      new (p + i) T;
+    return p;
+  }
+
+private:
+  Arena();
+  void *allocate_slow(u64 size, u64 align);
+
+  u8 *cur = nullptr;
+  u8 *end = nullptr;
+
+  std::string name;
+  Counter counter{name};
+};
+
+//
+// io_uring.cc
+//
+
+u8 *read_with_io_uring(int fd, u64 size, std::string_view name);
+
 //
 // mapfile.cc
 //
@@ -974,8 +1466,10 @@ inline char *socket_tmpfile;
 
 std::function<void()> fork_child();
 bool resume_daemon(char **argv, int *code);
-void daemonize(char **argv, std::function<void()> *wait_for_client,
-               std::function<void()> *on_complete);
+void watch_file(std::string path, std::string target);
+char **daemonize(char **argv, std::function<void(char **)> preload,
+                 std::function<void(std::span<std::string>)> reload,
+                 std::function<void()> *on_complete);
 
 //
 // main.cc
@@ -992,6 +1486,7 @@ namespace out {
 inline std::vector<ObjectFile *> objs;
 inline std::vector<SharedFile *> dsos;
 inline std::vector<OutputChunk *> chunks;
+inline std::vector<SymbolAux> symbol_aux;
 inline u8 *buf;
 
 inline ObjectFile *internal_file;
@@ -1008,6 +1503,7 @@ inline DynamicSection *dynamic;
 inline StrtabSection *strtab;
 inline DynstrSection *dynstr;
 inline HashSection *hash;
+inline GnuHashSection *gnu_hash;
 inline ShstrtabSection *shstrtab;
 inline PltSection *plt;
 inline SymtabSection *symtab;
@@ -1016,6 +1512,8 @@ inline CopyrelSection *copyrel;
 inline VersymSection *versym;
 inline VerneedSection *verneed;
 inline BuildIdSection *buildid;
+inline EhFrameSection *eh_frame;
+inline EhFrameHdrSection *eh_frame_hdr;
 
 inline u64 tls_begin;
 inline u64 tls_end;
@@ -1054,6 +1552,16 @@ inline u64 Symbol::get_addr() const {
     return out::copyrel->shdr.sh_addr + value;
 
   if (input_section) {
+    if (input_section->is_ehframe) {
+      // .eh_frame contents are parsed and reconstructed by the linker,
+      // so pointing to a specific location in a source .eh_frame
+      // section doesn't make much sense. However, CRT files contain
+      // symbols pointing to the very beginning and ending of the section.
+      if (name == "__FRAME_END__")
+        return out::eh_frame->shdr.sh_addr + out::eh_frame->shdr.sh_size - 4;
+      return out::eh_frame->shdr.sh_addr;
+    }
+
     if (!input_section->is_alive) {
       // The control can reach here if there's a relocation that refers
       // a local symbol belonging to a comdat group section. This is a
@@ -1073,28 +1581,41 @@ inline u64 Symbol::get_addr() const {
 }
 
 inline u64 Symbol::get_got_addr() const {
-  assert(got_idx != -1);
-  return out::got->shdr.sh_addr + got_idx * GOT_SIZE;
+  assert(aux().got_idx != -1);
+  return out::got->shdr.sh_addr + aux().got_idx * GOT_SIZE;
 }
 
 inline u64 Symbol::get_gotplt_addr() const {
-  assert(gotplt_idx != -1);
-  return out::gotplt->shdr.sh_addr + gotplt_idx * GOT_SIZE;
+  assert(aux().gotplt_idx != -1);
+  return out::gotplt->shdr.sh_addr + aux().gotplt_idx * GOT_SIZE;
 }
 
 inline u64 Symbol::get_gottpoff_addr() const {
-  assert(gottpoff_idx != -1);
-  return out::got->shdr.sh_addr + gottpoff_idx * GOT_SIZE;
+  assert(aux().gottpoff_idx != -1);
+  return out::got->shdr.sh_addr + aux().gottpoff_idx * GOT_SIZE;
 }
 
 inline u64 Symbol::get_tlsgd_addr() const {
-  assert(tlsgd_idx != -1);
-  return out::got->shdr.sh_addr + tlsgd_idx * GOT_SIZE;
+  assert(aux().tlsgd_idx != -1);
+  return out::got->shdr.sh_addr + aux().tlsgd_idx * GOT_SIZE;
 }
 
 inline u64 Symbol::get_plt_addr() const {
-  assert(plt_idx != -1);
-  return out::plt->shdr.sh_addr + plt_idx * PLT_SIZE;
+  assert(aux().plt_idx != -1);
+  return out::plt->shdr.sh_addr + aux().plt_idx * PLT_SIZE;
+}
+
+inline const SymbolAux &Symbol::aux() const {
+  static const SymbolAux none;
+  return (aux_idx == -1) ? none : out::symbol_aux[aux_idx];
+}
+
+inline SymbolAux &Symbol::alloc_aux() {
+  if (aux_idx == -1) {
+    aux_idx = out::symbol_aux.size();
+    out::symbol_aux.push_back({});
+  }
+  return out::symbol_aux[aux_idx];
 }
 
 inline u64 StringPiece::get_addr() const {
@@ -1118,6 +1639,13 @@ inline u32 elf_hash(std::string_view name) {
   return h;
 }
 
+inline u32 gnu_hash(std::string_view name) {
+  u32 h = 5381;
+  for (u8 c : name)
+    h = (h << 5) + h + c;
+  return h;
+}
+
 inline void write_string(u8 *buf, std::string_view str) {
   memcpy(buf, str.data(), str.size());
   buf[str.size()] = '\0';
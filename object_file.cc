@@ -6,14 +6,19 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <tbb/parallel_for.h>
 #include <unistd.h>
+#include <zlib.h>
 
 MemoryMappedFile *MemoryMappedFile::open(std::string path) {
   struct stat st;
   if (stat(path.c_str(), &st) == -1)
     return nullptr;
   u64 mtime = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
-  return new MemoryMappedFile(path, nullptr, st.st_size, mtime);
+  MemoryMappedFile *mb = new MemoryMappedFile(path, nullptr, st.st_size, mtime);
+  mb->dev = st.st_dev;
+  mb->ino = st.st_ino;
+  return mb;
 }
 
 MemoryMappedFile *MemoryMappedFile::must_open(std::string path) {
@@ -22,6 +27,25 @@ MemoryMappedFile *MemoryMappedFile::must_open(std::string path) {
   Fatal() << "cannot open " << path;
 }
 
+// Creates a file without accessing it. Thin archive members are
+// opened this way, so that they are stat'ed and mapped in parallel
+// by parser threads only when they are needed.
+MemoryMappedFile *MemoryMappedFile::open_deferred(std::string path) {
+  MemoryMappedFile *mb = new MemoryMappedFile(path, nullptr, 0);
+  mb->is_deferred = true;
+  return mb;
+}
+
+// With --input-io=io_uring, files are read into memory as a whole.
+// Archives are mapped instead, because most of their members are
+// never pulled out, and their pages are read only when accessed.
+static bool use_io_uring(int fd) {
+  if (!config.input_io_uring)
+    return false;
+  char magic[8];
+  return pread(fd, magic, 8, 0) != 8 || memcmp(magic, "!<arch>\n", 8);
+}
+
 u8 *MemoryMappedFile::data() {
   if (data_)
     return data_;
@@ -34,27 +58,132 @@ u8 *MemoryMappedFile::data() {
   if (fd == -1)
     Fatal() << name << ": cannot open: " << strerror(errno);
 
-  data_ = (u8 *)mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
-  if (data_ == MAP_FAILED)
-    Fatal() << name << ": mmap failed: " << strerror(errno);
+  if (is_deferred) {
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+      Fatal() << name << ": stat failed: " << strerror(errno);
+    size_ = st.st_size;
+    mtime = (u64)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    dev = st.st_dev;
+    ino = st.st_ino;
+  }
+
+  if (read_into_memory) {
+    u8 *buf = new u8[size_];
+    for (u64 off = 0; off < size_;) {
+      ssize_t n = pread(fd, buf + off, size_ - off, off);
+      if (n <= 0)
+        Fatal() << name << ": read failed: " << strerror(errno);
+      off += n;
+    }
+    data_ = buf;
+  } else if (u8 *buf = use_io_uring(fd) ?
+                        read_with_io_uring(fd, size_, name) : nullptr) {
+    data_ = buf;
+  } else {
+    data_ = (u8 *)mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data_ == MAP_FAILED)
+      Fatal() << name << ": mmap failed: " << strerror(errno);
+    is_mmapped = true;
+  }
+
   close(fd);
   return data_;
 }
 
+// Returns the first `size` bytes of a file, or the whole file if it
+// is shorter. With --input-io=io_uring, this reads only the requested
+// bytes, so that detecting file types doesn't read whole files before
+// parser threads start.
+std::string_view MemoryMappedFile::peek(u64 size) {
+  if (data_ || is_deferred || !config.input_io_uring)
+    return {(char *)data(), std::min(size, this->size())};
+
+  std::lock_guard lock(mu);
+  if (data_)
+    return {(char *)data_.load(), std::min(size, size_)};
+
+  if (head.size() < std::min(size, size_)) {
+    int fd = ::open(name.c_str(), O_RDONLY);
+    if (fd == -1)
+      Fatal() << name << ": cannot open: " << strerror(errno);
+
+    head.resize(std::min(size, size_));
+    ssize_t n = pread(fd, head.data(), head.size(), 0);
+    close(fd);
+    if (n != head.size())
+      Fatal() << name << ": read failed: " << strerror(errno);
+  }
+  return std::string_view(head).substr(0, size);
+}
+
+#ifndef MADV_POPULATE_READ
+# define MADV_POPULATE_READ 22
+#endif
+
+// Asks the kernel to read a file ahead of time, so that parser threads
+// don't block on page faults. Small files are mapped into page tables
+// as a whole. Large files are read ahead asynchronously and are backed
+// by huge pages if the kernel supports it for files.
+void MemoryMappedFile::prefetch() {
+  static Counter prefetched("prefetched_bytes");
+  static Counter cold("cold_pages");
+
+  if (parent || (is_deferred && !data_))
+    return;
+
+  // Files read into memory don't need this.
+  u8 *buf = data();
+  if (!is_mmapped)
+    return;
+
+  // With io_uring, archives are mapped so that only members that are
+  // pulled out are read. Don't read them ahead as a whole.
+  if (config.input_io_uring && size_ >= 8 && !memcmp(buf, "!<arch>\n", 8))
+    return;
+  i64 page_size = sysconf(_SC_PAGESIZE);
+  i64 num_pages = (size_ + page_size - 1) / page_size;
+
+  std::vector<u8> vec(num_pages);
+  if (mincore(buf, size_, vec.data()) == 0) {
+    i64 num_cold = 0;
+    for (u8 x : vec)
+      if (!(x & 1))
+        num_cold++;
+    cold.inc(num_cold);
+  }
+
+  prefetched.inc(size_);
+
+  if (size_ <= (1 << 20) && madvise(buf, size_, MADV_POPULATE_READ) == 0)
+    return;
+
+  madvise(buf, size_, MADV_WILLNEED);
+  if (size_ >= (2 << 20))
+    madvise(buf, size_, MADV_HUGEPAGE);
+}
+
 MemoryMappedFile *MemoryMappedFile::slice(std::string name, u64 start, u64 size) {
-  MemoryMappedFile *mb = new MemoryMappedFile(name, data_ + start, size);
+  MemoryMappedFile *mb = new MemoryMappedFile(name, data_ + start, size, mtime);
   mb->parent = this;
   return mb;
 }
 
-InputFile::InputFile(MemoryMappedFile *mb) : mb(mb), name(mb->name) {
+// The constructor doesn't access file contents, so that archive
+// members that are never pulled out are never read. The ELF header is
+// read by the parser threads instead.
+InputFile::InputFile(MemoryMappedFile *mb) : mb(mb), name(mb->name) {}
+
+void InputFile::read_header() {
+  if (elf_sections.data())
+    return;
+
   if (mb->size() < sizeof(ElfEhdr))
     Fatal() << *this << ": file too small";
   if (memcmp(mb->data(), "\177ELF", 4))
     Fatal() << *this << ": not an ELF file";
 
   ElfEhdr &ehdr = *(ElfEhdr *)mb->data();
-  is_dso = (ehdr.e_type == ET_DYN);
 
   u8 *sh_begin = mb->data() + ehdr.e_shoff;
   u8 *sh_end = sh_begin + ehdr.e_shnum * sizeof(ElfShdr);
@@ -101,6 +230,38 @@ ElfShdr *InputFile::find_section(u32 type) {
   return nullptr;
 }
 
+// Returns the number of defined global symbols without parsing the
+// file. This is used to pre-size the symbol table. Undefined symbols
+// are not counted, because they mostly refer to names that other files
+// define, and counting them would oversize the table many times over.
+i64 InputFile::count_defined_symbols() {
+  read_header();
+  ElfShdr *sec = find_section(is_dso ? SHT_DYNSYM : SHT_SYMTAB);
+  if (!sec)
+    return 0;
+
+  std::span<ElfSym> syms = get_data<ElfSym>(*sec);
+  if (syms.size() < sec->sh_info)
+    return 0;
+
+  i64 n = 0;
+  for (ElfSym &sym : syms.subspan(sec->sh_info))
+    if (!sym.is_undef())
+      n++;
+  return n;
+}
+
+// Returns an upper bound of the number of comdat groups, which is
+// used to pre-size the comdat group table.
+i64 InputFile::count_comdat_groups() {
+  read_header();
+  i64 n = 0;
+  for (ElfShdr &shdr : elf_sections)
+    if (shdr.sh_type == SHT_GROUP)
+      n++;
+  return n;
+}
+
 ObjectFile::ObjectFile(MemoryMappedFile *mb, std::string archive_name)
   : InputFile(mb), archive_name(archive_name),
     is_in_archive(archive_name != "") {
@@ -133,8 +294,8 @@ void ObjectFile::initialize_sections() {
       if (entries[0] != GRP_COMDAT)
         Fatal() << *this << ": unsupported SHT_GROUP format";
 
-      static ConcurrentMap<ComdatGroup> map;
-      ComdatGroup *group = map.insert(signature, ComdatGroup(nullptr, 0));
+      ComdatGroup *group =
+        ComdatGroup::get_map().insert(signature, ComdatGroup(nullptr, 0));
       comdat_groups.push_back({group, entries});
 
       static Counter counter("comdats");
@@ -155,7 +316,14 @@ void ObjectFile::initialize_sections() {
       counter.inc();
 
       std::string_view name = shstrtab.data() + shdr.sh_name;
-      this->sections[i] = new InputSection(this, shdr, name);
+
+      if (shdr.sh_flags & SHF_COMPRESSED) {
+        this->sections[i] = read_compressed_section(shdr, name);
+      } else {
+        this->sections[i] = Arena::make<InputSection>(this, shdr, name);
+        if (shdr.sh_type != SHT_NOBITS)
+          this->sections[i]->contents = get_string(shdr);
+      }
       break;
     }
     }
@@ -195,6 +363,16 @@ static bool should_write_symtab(const ElfSym &esym, std::string_view name) {
   return true;
 }
 
+// Returns a global symbol name without a version suffix.
+static std::string_view get_global_name(std::string_view strtab,
+                                        const ElfSym &esym) {
+  std::string_view name = strtab.data() + esym.st_name;
+  int pos = name.find('@');
+  if (pos != std::string_view::npos)
+    name = name.substr(0, pos);
+  return name;
+}
+
 void ObjectFile::initialize_symbols() {
   if (!symtab_sec)
     return;
@@ -203,7 +381,7 @@ void ObjectFile::initialize_symbols() {
   counter.inc(elf_syms.size());
 
   // Initialize local symbols
-  Symbol *locals = new Symbol[first_global];
+  Symbol *locals = Arena::make_array<Symbol>(first_global);
 
   for (int i = 1; i < first_global; i++) {
     const ElfSym &esym = elf_syms[i];
@@ -220,16 +398,9 @@ void ObjectFile::initialize_symbols() {
         Fatal() << *this << ": common local symbol?";
       sym.input_section = sections[esym.st_shndx];
     }
-
-    if (should_write_symtab(esym, sym.name)) {
-      sym.write_symtab = true;
-      strtab_size += sym.name.size() + 1;
-      local_symtab_size += sizeof(ElfSym);
-    }
   }
 
   symbols.resize(elf_syms.size());
-  sym_pieces.resize(elf_syms.size() - first_global);
 
   for (int i = 0; i < first_global; i++)
     symbols[i] = &locals[i];
@@ -237,18 +408,146 @@ void ObjectFile::initialize_symbols() {
   // Initialize global symbols
   for (int i = first_global; i < elf_syms.size(); i++) {
     const ElfSym &esym = elf_syms[i];
-    std::string_view name = symbol_strtab.data() + esym.st_name;
-    int pos = name.find('@');
-    if (pos != std::string_view::npos)
-      name = name.substr(0, pos);
-
-    symbols[i] = Symbol::intern(name);
+    symbols[i] = Symbol::intern(get_global_name(symbol_strtab, esym));
 
     if (esym.is_common())
       has_common_symbol = true;
   }
 }
 
+// Decompresses a SHF_COMPRESSED section. Since the output section
+// size depends on the uncompressed size, we do this at parse time,
+// which runs in parallel for each file.
+InputSection *
+ObjectFile::read_compressed_section(const ElfShdr &shdr, std::string_view name) {
+  static Counter counter("uncompressed_bytes");
+
+  std::string_view data = get_string(shdr);
+  if (data.size() < sizeof(ElfChdr))
+    Fatal() << *this << ": " << name << ": corrupted compressed section";
+
+  ElfChdr &chdr = *(ElfChdr *)data.data();
+  if (chdr.ch_type != ELFCOMPRESS_ZLIB)
+    Fatal() << *this << ": " << name << ": unsupported compression type";
+
+  unsigned long size = chdr.ch_size;
+  u8 *buf = (u8 *)Arena::get().allocate(size, 1);
+
+  if (uncompress(buf, &size, (u8 *)data.data() + sizeof(ElfChdr),
+                 data.size() - sizeof(ElfChdr)) != Z_OK ||
+      size != chdr.ch_size)
+    Fatal() << *this << ": " << name << ": uncompress failed";
+
+  ElfShdr *shdr2 = Arena::make<ElfShdr>(shdr);
+  shdr2->sh_flags &= ~(u64)SHF_COMPRESSED;
+  shdr2->sh_size = chdr.ch_size;
+  shdr2->sh_addralign = chdr.ch_addralign;
+
+  InputSection *isec = Arena::make<InputSection>(this, *shdr2, name);
+  isec->contents = {(char *)buf, size};
+  counter.inc(size);
+  return isec;
+}
+
+void ObjectFile::initialize_ehframe_sections() {
+  for (int i = 0; i < sections.size(); i++) {
+    InputSection *isec = sections[i];
+    if (isec && isec->name == ".eh_frame") {
+      read_ehframe(*isec);
+      isec->is_ehframe = true;
+      sections[i] = nullptr;
+    }
+  }
+
+  static Counter counter("ehframe_records");
+  counter.inc(cies.size() + fdes.size());
+
+  // Sort FDEs by their target sections so that each section can refer
+  // its FDEs as a contiguous range.
+  auto get_target_shndx = [&](const FdeRecord &fde) -> u32 {
+    if (fde.rels.empty() || fde.rels[0].r_offset != fde.input_offset + 8)
+      return -1;
+    const ElfSym &esym = elf_syms[fde.rels[0].r_sym];
+    if (esym.is_abs() || esym.is_common() || esym.is_undef())
+      return -1;
+    return esym.st_shndx;
+  };
+
+  sort(fdes, [&](const FdeRecord &a, const FdeRecord &b) {
+    return get_target_shndx(a) < get_target_shndx(b);
+  });
+
+  for (int i = 0; i < fdes.size();) {
+    u32 shndx = get_target_shndx(fdes[i]);
+    int begin = i++;
+    while (i < fdes.size() && get_target_shndx(fdes[i]) == shndx)
+      i++;
+
+    if (shndx < sections.size() && sections[shndx]) {
+      sections[shndx]->fde_begin = begin;
+      sections[shndx]->fde_end = i;
+    }
+  }
+}
+
+void ObjectFile::read_ehframe(InputSection &isec) {
+  std::span<ElfRela> rels = isec.rels;
+  std::string_view data = isec.contents;
+  const char *begin = data.data();
+
+  for (int i = 1; i < rels.size(); i++)
+    if (rels[i].r_offset < rels[i - 1].r_offset)
+      Fatal() << isec << ": relocations are not sorted";
+
+  int cies_begin = cies.size();
+  int rel_idx = 0;
+
+  while (!data.empty()) {
+    if (data.size() < 4)
+      Fatal() << isec << ": garbage at end of section";
+
+    u32 size = *(u32 *)data.data();
+    if (size == 0) {
+      if (data.size() != 4)
+        Fatal() << isec << ": garbage at end of section";
+      break;
+    }
+    if (size == 0xffffffff)
+      Fatal() << isec << ": 64-bit .eh_frame records are not supported";
+    if (size < 4)
+      Fatal() << isec << ": record is too small";
+    if (size > data.size() - 4)
+      Fatal() << isec << ": record overruns the section";
+
+    u32 input_offset = data.data() - begin;
+    u32 end_offset = input_offset + size + 4;
+    std::string_view contents = data.substr(0, size + 4);
+    data = data.substr(size + 4);
+
+    int rel_begin = rel_idx;
+    while (rel_idx < rels.size() && rels[rel_idx].r_offset < end_offset)
+      rel_idx++;
+    std::span<ElfRela> rec_rels = rels.subspan(rel_begin, rel_idx - rel_begin);
+
+    u32 id = *(u32 *)(contents.data() + 4);
+    if (id == 0) {
+      cies.push_back(CieRecord{this, contents, rec_rels, input_offset});
+      continue;
+    }
+
+    u32 cie_offset = input_offset + 4 - id;
+    int cie_idx = -1;
+    for (int i = cies_begin; i < cies.size(); i++)
+      if (cies[i].input_offset == cie_offset)
+        cie_idx = i;
+
+    if (cie_idx == -1)
+      Fatal() << isec << ": bad FDE pointer";
+    fdes.push_back(FdeRecord{contents, rec_rels, input_offset, (u32)-1,
+                             (u32)cie_idx});
+  }
+}
+
 static int binary_search(std::span<u32> span, u32 val) {
   if (val < span[0])
     return -1;
@@ -268,25 +567,76 @@ static int binary_search(std::span<u32> span, u32 val) {
 
 static bool is_mergeable(const ElfShdr &shdr) {
   return (shdr.sh_flags & SHF_MERGE) &&
-         (shdr.sh_flags & SHF_STRINGS) &&
-         shdr.sh_entsize == 1;
+         shdr.sh_type != SHT_NOBITS &&
+         shdr.sh_entsize > 0 &&
+         shdr.sh_size % shdr.sh_entsize == 0;
+}
+
+// Returns the index of the piece containing a given offset. References
+// to mergeable sections are usually in ascending order, so we first
+// gallop forward from the previous result and then binary-search only
+// the last interval. That's linear for sorted references.
+static int find_piece(MergeableSection &m, u32 offset, int &hint) {
+  std::span<u32> span = m.piece_offsets;
+  if (span.empty() || offset < span[0])
+    return -1;
+
+  int lo = 0;
+  int len = span.size();
+
+  if (0 <= hint && hint < span.size() && span[hint] <= offset) {
+    int step = 1;
+    lo = hint;
+    while (lo + step < span.size() && span[lo + step] <= offset) {
+      lo += step;
+      step *= 2;
+    }
+    len = std::min<int>(step, span.size() - lo);
+  }
+
+  hint = lo + binary_search(span.subspan(lo, len), offset);
+  return hint;
 }
 
 void ObjectFile::initialize_mergeable_sections() {
   mergeable_sections.resize(sections.size());
 
-  for (int i = 0; i < sections.size(); i++) {
+  tbb::parallel_for(0, (int)sections.size(), [&](int i) {
     InputSection *isec = sections[i];
     if (isec && is_mergeable(isec->shdr)) {
-      mergeable_sections[i] = new MergeableSection(isec, get_string(isec->shdr));
+      mergeable_sections[i] = Arena::make<MergeableSection>(isec, isec->contents);
       sections[i] = nullptr;
     }
-  }
+  });
+}
 
-  // Initialize rel_pieces
-  for (InputSection *isec : sections) {
+// Interns pieces of mergeable sections and resolves references to
+// them. This is called after the string tables are reserved, so it is
+// separated from initialize_mergeable_sections().
+void ObjectFile::intern_string_pieces() {
+  tbb::parallel_for(0, (int)mergeable_sections.size(), [&](int i) {
+    if (mergeable_sections[i])
+      mergeable_sections[i]->intern_pieces();
+  });
+
+  // Initialize rel_pieces. Each input section has its own list of
+  // references, so sections are processed in parallel.
+  tbb::parallel_for(0, (int)sections.size(), [&](int j) {
+    InputSection *isec = sections[j];
     if (!isec || isec->rels.empty())
-      continue;
+      return;
+
+    // A section usually refers to only a few mergeable sections, so
+    // search hints are kept in a small list.
+    std::vector<std::pair<MergeableSection *, int>> hints;
+
+    auto get_hint = [&](MergeableSection *m) -> int & {
+      for (std::pair<MergeableSection *, int> &p : hints)
+        if (p.first == m)
+          return p.second;
+      hints.push_back({m, -1});
+      return hints.back().second;
+    };
 
     for (int i = 0; i < isec->rels.size(); i++) {
       const ElfRela &rel = isec->rels[i];
@@ -299,7 +649,7 @@ void ObjectFile::initialize_mergeable_sections() {
         continue;
 
       u32 offset = esym.st_value + rel.r_addend;
-      int idx = binary_search(m->piece_offsets, offset);
+      int idx = find_piece(*m, offset, get_hint(m));
       if (idx == -1)
         Fatal() << *this << ": bad relocation at " << rel.r_sym;
 
@@ -307,9 +657,11 @@ void ObjectFile::initialize_mergeable_sections() {
       isec->rel_pieces.push_back(ref);
       isec->has_rel_piece[i] = true;
     }
-  }
+  });
+
+  // Initialize piece_refs of symbols defined by this file
+  std::vector<int> hints(sections.size(), -1);
 
-  // Initialize sym_pieces
   for (int i = 0; i < elf_syms.size(); i++) {
     const ElfSym &esym = elf_syms[i];
     if (esym.is_abs() || esym.is_common())
@@ -319,16 +671,14 @@ void ObjectFile::initialize_mergeable_sections() {
     if (!m)
       continue;
 
-    int idx = binary_search(m->piece_offsets, esym.st_value);
+    int idx = find_piece(*m, esym.st_value, hints[esym.st_shndx]);
     if (idx == -1)
       Fatal() << *this << ": bad symbol value";
 
-    if (i < first_global) {
-      symbols[i]->piece_ref.piece = m->pieces[idx];
-      symbols[i]->piece_ref.addend = esym.st_value - m->piece_offsets[idx];
-    } else {
-      sym_pieces[i - first_global].piece = m->pieces[idx];
-      sym_pieces[i - first_global].addend = esym.st_value - m->piece_offsets[idx];
+    Symbol &sym = *symbols[i];
+    if (i < first_global || sym.file == this) {
+      sym.piece_ref.piece = m->pieces[idx];
+      sym.piece_ref.addend = esym.st_value - m->piece_offsets[idx];
     }
   }
 
@@ -336,6 +686,8 @@ void ObjectFile::initialize_mergeable_sections() {
 }
 
 void ObjectFile::parse() {
+  read_header();
+  is_lazy = false;
   sections.resize(elf_sections.size());
   symtab_sec = find_section(SHT_SYMTAB);
 
@@ -347,9 +699,38 @@ void ObjectFile::parse() {
 
   initialize_sections();
   initialize_symbols();
+  initialize_ehframe_sections();
   initialize_mergeable_sections();
 }
 
+// Reads only defined global symbol names of an archive member that
+// doesn't have an archive symbol table. Sections are read later by
+// parse() if the member is pulled out.
+void ObjectFile::read_lazy_symbols() {
+  read_header();
+  std::vector<std::string_view> names;
+
+  if (ElfShdr *sec = find_section(SHT_SYMTAB)) {
+    std::span<ElfSym> esyms = get_data<ElfSym>(*sec);
+    std::string_view strtab = get_string(sec->sh_link);
+
+    for (int i = sec->sh_info; i < esyms.size(); i++)
+      if (esyms[i].is_defined())
+        names.push_back(get_global_name(strtab, esyms[i]));
+  }
+  read_lazy_symbols(names);
+}
+
+void ObjectFile::read_lazy_symbols(std::span<std::string_view> names) {
+  static Counter counter("lazy_members");
+  counter.inc();
+
+  is_lazy = true;
+  lazy_symbols.reserve(names.size());
+  for (std::string_view name : names)
+    lazy_symbols.push_back(Symbol::intern(name));
+}
+
 // Symbols with higher priorities overwrites symbols with lower priorities.
 // Here is the list of priorities, from the highest to the lowest.
 //
@@ -371,29 +752,79 @@ static u64 get_rank(InputFile *file, const ElfSym &esym, InputSection *isec) {
   return file->priority;
 }
 
-static u64 get_rank(const Symbol &sym) {
-  if (!sym.file)
-    return (u64)4 << 32;
-  if (sym.is_placeholder)
-    return ((u64)3 << 32) + sym.file->priority;
-  return get_rank(sym.file, *sym.esym, sym.input_section);
+static u64 get_placeholder_rank(InputFile *file) {
+  return ((u64)3 << 32) + file->priority;
 }
 
-void ObjectFile::maybe_override_symbol(Symbol &sym, int symidx) {
-  InputSection *isec = nullptr;
+// Symbol resolution is done in two passes. In the first pass, files
+// compete for symbols by lowering their ranks with CAS. Since a rank
+// contains a file priority, there's exactly one winner for each
+// symbol. In the second pass, the winner fills in the details of
+// the symbol. Neither pass needs a lock. Since the minimum rank over
+// a given set of files is unique, the winner doesn't depend on the
+// order in which files are processed.
+static void claim_symbol(Symbol &sym, u64 rank) {
+  u64 cur = sym.rank;
+  while (rank < cur && !sym.rank.compare_exchange_weak(cur, rank));
+}
+
+u64 ObjectFile::get_symbol_rank(int symidx) {
   const ElfSym &esym = elf_syms[symidx];
+  if (is_in_archive && !is_alive)
+    return get_placeholder_rank(this);
+
+  InputSection *isec = nullptr;
   if (!esym.is_abs() && !esym.is_common())
     isec = sections[esym.st_shndx];
+  return get_rank(this, esym, isec);
+}
+
+static void set_placeholder(Symbol &sym, ObjectFile *file) {
+  sym.file = file;
+  sym.is_placeholder = true;
+
+  if (sym.traced)
+    SyncOut() << "trace: " << *file << ": lazy definition of " << sym.name;
+}
+
+void ObjectFile::resolve_symbols() {
+  if (is_lazy) {
+    for (Symbol *sym : lazy_symbols)
+      claim_symbol(*sym, get_placeholder_rank(this));
+    return;
+  }
+
+  for (int i = first_global; i < symbols.size(); i++)
+    if (elf_syms[i].is_defined())
+      claim_symbol(*symbols[i], get_symbol_rank(i));
+}
+
+void ObjectFile::update_symbols() {
+  if (is_lazy) {
+    for (Symbol *sym : lazy_symbols)
+      if (sym->rank == get_placeholder_rank(this))
+        set_placeholder(*sym, this);
+    return;
+  }
+
+  for (int i = first_global; i < symbols.size(); i++) {
+    const ElfSym &esym = elf_syms[i];
+    Symbol &sym = *symbols[i];
+    if (!esym.is_defined() || sym.rank != get_symbol_rank(i))
+      continue;
 
-  std::lock_guard lock(sym.mu);
+    if (is_in_archive && !is_alive) {
+      set_placeholder(sym, this);
+      continue;
+    }
 
-  u64 new_rank = get_rank(this, esym, isec);
-  u64 existing_rank = get_rank(sym);
+    InputSection *isec = nullptr;
+    if (!esym.is_abs() && !esym.is_common())
+      isec = sections[esym.st_shndx];
 
-  if (new_rank < existing_rank) {
     sym.file = this;
     sym.input_section = isec;
-    sym.piece_ref = sym_pieces[symidx - first_global];
+    sym.piece_ref = {};
     sym.value = esym.st_value;
     sym.ver_idx = 0;
     sym.st_type = esym.st_type;
@@ -409,33 +840,6 @@ void ObjectFile::maybe_override_symbol(Symbol &sym, int symidx) {
   }
 }
 
-void ObjectFile::resolve_symbols() {
-  for (int i = first_global; i < symbols.size(); i++) {
-    const ElfSym &esym = elf_syms[i];
-    if (!esym.is_defined())
-      continue;
-
-    Symbol &sym = *symbols[i];
-
-    if (is_in_archive) {
-      std::lock_guard lock(sym.mu);
-      bool is_new = !sym.file;
-      bool tie_but_higher_priority =
-        sym.is_placeholder && this->priority < sym.file->priority;
-
-      if (is_new || tie_but_higher_priority) {
-        sym.file = this;
-        sym.is_placeholder = true;
-
-        if (sym.traced)
-          SyncOut() << "trace: " << sym.file << ": lazy definition of " << sym.name;
-      }
-    } else {
-      maybe_override_symbol(sym, i);
-    }
-  }
-}
-
 std::vector<ObjectFile *> ObjectFile::mark_live_objects() {
   std::vector<ObjectFile *> vec;
   assert(is_alive);
@@ -446,7 +850,7 @@ std::vector<ObjectFile *> ObjectFile::mark_live_objects() {
 
     if (esym.is_defined()) {
       if (is_in_archive)
-        maybe_override_symbol(sym, i);
+        claim_symbol(sym, get_symbol_rank(i));
       continue;
     }
 
@@ -468,29 +872,30 @@ std::vector<ObjectFile *> ObjectFile::mark_live_objects() {
 void ObjectFile::handle_undefined_weak_symbols() {
   for (int i = first_global; i < symbols.size(); i++) {
     const ElfSym &esym = elf_syms[i];
+    if (esym.is_undef() && esym.st_bind == STB_WEAK)
+      claim_symbol(*symbols[i], get_rank(this, esym, nullptr));
+  }
+}
 
-    if (esym.is_undef() && esym.st_bind == STB_WEAK) {
-      Symbol &sym = *symbols[i];
-      std::lock_guard lock(sym.mu);
-
-      bool is_new = !sym.file || sym.is_placeholder;
-      bool tie_but_higher_priority =
-        !is_new && sym.is_undef_weak && this->priority < sym.file->priority;
-
-      if (is_new || tie_but_higher_priority) {
-        sym.file = this;
-        sym.input_section = nullptr;
-        sym.value = 0;
-        sym.esym = &esym;
-        sym.is_placeholder = false;
-        sym.is_undef_weak = true;
-        sym.is_imported = false;
-
-        if (sym.traced)
-          SyncOut() << "trace: " << *this << ": unresolved weak symbol "
-                    << sym.name;
-      }
-    }
+void ObjectFile::update_undefined_weak_symbols() {
+  for (int i = first_global; i < symbols.size(); i++) {
+    const ElfSym &esym = elf_syms[i];
+    Symbol &sym = *symbols[i];
+    if (!esym.is_undef() || esym.st_bind != STB_WEAK ||
+        sym.rank != get_rank(this, esym, nullptr))
+      continue;
+
+    sym.file = this;
+    sym.input_section = nullptr;
+    sym.value = 0;
+    sym.esym = &esym;
+    sym.is_placeholder = false;
+    sym.is_undef_weak = true;
+    sym.is_imported = false;
+
+    if (sym.traced)
+      SyncOut() << "trace: " << *this << ": unresolved weak symbol "
+                << sym.name;
   }
 }
 
@@ -537,14 +942,14 @@ void ObjectFile::convert_common_symbols() {
     if (sym->file != this)
       continue;
 
-    auto *shdr = new ElfShdr;
+    auto *shdr = Arena::make<ElfShdr>();
     memset(shdr, 0, sizeof(*shdr));
     shdr->sh_flags = SHF_ALLOC;
     shdr->sh_type = SHT_NOBITS;
     shdr->sh_size = elf_syms[i].st_size;
     shdr->sh_addralign = 1;
 
-    auto *isec = new InputSection(this, *shdr, ".bss");
+    auto *isec = Arena::make<InputSection>(this, *shdr, ".bss");
     isec->output_section = bss;
     sections.push_back(isec);
 
@@ -553,11 +958,68 @@ void ObjectFile::convert_common_symbols() {
   }
 }
 
+void ObjectFile::scan_ehframe_relocations() {
+  auto scan = [&](std::span<ElfRela> rels) {
+    for (const ElfRela &rel : rels) {
+      Symbol &sym = *symbols[rel.r_sym];
+
+      if (!sym.file || sym.is_placeholder) {
+        Error() << "undefined symbol: " << *this << ": " << sym.name;
+        continue;
+      }
+
+      if (sym.is_imported)
+        sym.flags |= (sym.st_type == STT_FUNC) ? NEEDS_PLT : NEEDS_COPYREL;
+    }
+  };
+
+  for (CieRecord &cie : cies)
+    if (cie.leader == &cie)
+      scan(cie.rels);
+
+  for (FdeRecord &fde : fdes)
+    if (fde.is_alive)
+      scan(fde.rels);
+}
+
+bool CieRecord::should_merge(const CieRecord &other) const {
+  if (contents != other.contents || rels.size() != other.rels.size())
+    return false;
+
+  for (int i = 0; i < rels.size(); i++) {
+    const ElfRela &a = rels[i];
+    const ElfRela &b = other.rels[i];
+    if (a.r_offset - input_offset != b.r_offset - other.input_offset ||
+        a.r_type != b.r_type ||
+        a.r_addend != b.r_addend ||
+        file->symbols[a.r_sym] != other.file->symbols[b.r_sym])
+      return false;
+  }
+  return true;
+}
+
+static bool is_in_live_section(Symbol &sym) {
+  return !sym.input_section || sym.input_section->is_alive;
+}
+
 static bool should_write_global_symtab(Symbol &sym) {
-  return !config.strip_all && sym.esym->st_type != STT_SECTION;
+  return !config.strip_all && sym.esym->st_type != STT_SECTION &&
+         is_in_live_section(sym);
 }
 
 void ObjectFile::compute_symtab() {
+  // Symbols belonging to sections that were discarded by comdat
+  // elimination or garbage collection are not written to the symtab.
+  for (int i = 1; i < first_global; i++) {
+    Symbol &sym = *symbols[i];
+
+    if (should_write_symtab(*sym.esym, sym.name) && is_in_live_section(sym)) {
+      sym.write_symtab = true;
+      strtab_size += sym.name.size() + 1;
+      local_symtab_size += sizeof(ElfSym);
+    }
+  }
+
   for (int i = first_global; i < elf_syms.size(); i++) {
     const ElfSym &esym = elf_syms[i];
     Symbol &sym = *symbols[i];
@@ -588,7 +1050,9 @@ void ObjectFile::write_symtab() {
     else
       esym.st_value = sym.get_addr();
 
-    if (sym.input_section)
+    if (sym.input_section && sym.input_section->is_ehframe)
+      esym.st_shndx = out::eh_frame->shndx;
+    else if (sym.input_section)
       esym.st_shndx = sym.input_section->output_section->shndx;
     else if (sym.shndx)
       esym.st_shndx = sym.shndx;
@@ -663,7 +1127,6 @@ ObjectFile::ObjectFile() {
   }
 
   elf_syms = *esyms;
-  sym_pieces.resize(elf_syms.size() - first_global);
 }
 
 std::ostream &operator<<(std::ostream &out, const InputFile &file) {
@@ -689,6 +1152,7 @@ std::string_view SharedFile::get_soname() {
 }
 
 void SharedFile::parse() {
+  read_header();
   symtab_sec = find_section(SHT_DYNSYM);
   if (!symtab_sec)
     return;
@@ -768,32 +1232,32 @@ std::vector<std::string_view> SharedFile::read_verdef() {
 }
 
 void SharedFile::resolve_symbols() {
+  for (int i = 0; i < symbols.size(); i++)
+    claim_symbol(*symbols[i], get_rank(this, *elf_syms[i], nullptr));
+}
+
+void SharedFile::update_symbols() {
   for (int i = 0; i < symbols.size(); i++) {
     Symbol &sym = *symbols[i];
     const ElfSym &esym = *elf_syms[i];
+    if (sym.rank != get_rank(this, esym, nullptr))
+      continue;
 
-    std::lock_guard lock(sym.mu);
-
-    u64 new_rank = get_rank(this, esym, nullptr);
-    u64 existing_rank = get_rank(sym);
-
-    if (new_rank < existing_rank) {
-      sym.file = this;
-      sym.input_section = nullptr;
-      sym.piece_ref = {};
-      sym.value = esym.st_value;
-      sym.ver_idx = versyms[i];
-      sym.st_type = (esym.st_type == STT_GNU_IFUNC) ? STT_FUNC : esym.st_type;
-      sym.esym = &esym;
-      sym.is_placeholder = false;
-      sym.is_weak = (esym.st_bind == STB_WEAK);
-      sym.is_imported = true;
+    sym.file = this;
+    sym.input_section = nullptr;
+    sym.piece_ref = {};
+    sym.value = esym.st_value;
+    sym.ver_idx = versyms[i];
+    sym.st_type = (esym.st_type == STT_GNU_IFUNC) ? STT_FUNC : esym.st_type;
+    sym.esym = &esym;
+    sym.is_placeholder = false;
+    sym.is_weak = (esym.st_bind == STB_WEAK);
+    sym.is_imported = true;
 
-      if (sym.traced)
-        SyncOut() << "trace: " << *sym.file
-                  << (sym.is_weak ? ": weak definition of " : ": definition of ")
-                  << sym.name;
-    }
+    if (sym.traced)
+      SyncOut() << "trace: " << *sym.file
+                << (sym.is_weak ? ": weak definition of " : ": definition of ")
+                << sym.name;
   }
 }
 
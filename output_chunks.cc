@@ -3,6 +3,9 @@
 #include <openssl/sha.h>
 #include <shared_mutex>
 #include <tbb/parallel_for_each.h>
+#include <tbb/parallel_sort.h>
+#include <unordered_map>
+#include <zlib.h>
 
 void OutputEhdr::copy_buf() {
   auto &hdr = *(ElfEhdr *)(out::buf + shdr.sh_offset);
@@ -143,6 +146,10 @@ std::vector<ElfPhdr> create_phdr() {
   if (out::dynamic)
     define(PT_DYNAMIC, PF_R | PF_W, out::dynamic->shdr.sh_addralign, out::dynamic);
 
+  // Add PT_GNU_EH_FRAME
+  if (out::eh_frame_hdr && out::eh_frame_hdr->shdr.sh_size)
+    define(PT_GNU_EH_FRAME, PF_R, 1, out::eh_frame_hdr);
+
   // Add PT_GNU_STACK, which is a marker segment that doesn't really
   // contain any segments. If exists, the runtime turn on the No Exeecute
   // bit for stack pages.
@@ -193,14 +200,14 @@ void RelDynSection::copy_buf() {
 
   for (Symbol *sym : out::got->got_syms) {
     if (sym->is_imported)
-      *rel++ = {sym->get_got_addr(), R_X86_64_GLOB_DAT, sym->dynsym_idx, 0};
+      *rel++ = {sym->get_got_addr(), R_X86_64_GLOB_DAT, sym->aux().dynsym_idx, 0};
     else if (config.pie && sym->is_relative())
       *rel++ = {sym->get_got_addr(), R_X86_64_RELATIVE, 0, (i64)sym->get_addr()};
   }
 
   for (Symbol *sym : out::got->tlsgd_syms) {
-    *rel++ = {sym->get_tlsgd_addr(), R_X86_64_DTPMOD64, sym->dynsym_idx, 0};
-    *rel++ = {sym->get_tlsgd_addr() + GOT_SIZE, R_X86_64_DTPOFF64, sym->dynsym_idx, 0};
+    *rel++ = {sym->get_tlsgd_addr(), R_X86_64_DTPMOD64, sym->aux().dynsym_idx, 0};
+    *rel++ = {sym->get_tlsgd_addr() + GOT_SIZE, R_X86_64_DTPOFF64, sym->aux().dynsym_idx, 0};
   }
 
   if (out::got->tlsld_idx != -1)
@@ -208,10 +215,10 @@ void RelDynSection::copy_buf() {
 
   for (Symbol *sym : out::got->gottpoff_syms)
     if (sym->is_imported)
-      *rel++ = {sym->get_gottpoff_addr(), R_X86_64_TPOFF32, sym->dynsym_idx, 0};
+      *rel++ = {sym->get_gottpoff_addr(), R_X86_64_TPOFF32, sym->aux().dynsym_idx, 0};
 
   for (Symbol *sym : out::copyrel->symbols)
-    *rel++ = {sym->get_addr(), R_X86_64_COPY, sym->dynsym_idx, 0};
+    *rel++ = {sym->get_addr(), R_X86_64_COPY, sym->aux().dynsym_idx, 0};
 }
 
 void StrtabSection::update_shdr() {
@@ -323,7 +330,10 @@ static std::vector<u64> create_dynamic_section() {
   define(DT_SYMENT, sizeof(ElfSym));
   define(DT_STRTAB, out::dynstr->shdr.sh_addr);
   define(DT_STRSZ, out::dynstr->shdr.sh_size);
-  define(DT_HASH, out::hash->shdr.sh_addr);
+  if (out::hash)
+    define(DT_HASH, out::hash->shdr.sh_addr);
+  if (out::gnu_hash)
+    define(DT_GNU_HASH, out::gnu_hash->shdr.sh_addr);
   define(DT_INIT_ARRAY, out::__init_array_start->value);
   define(DT_INIT_ARRAYSZ, out::__init_array_end->value - out::__init_array_start->value);
   define(DT_FINI_ARRAY, out::__fini_array_start->value);
@@ -439,22 +449,22 @@ void OutputSection::copy_buf() {
 }
 
 void GotSection::add_got_symbol(Symbol *sym) {
-  assert(sym->got_idx == -1);
-  sym->got_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->aux().got_idx == -1);
+  sym->alloc_aux().got_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE;
   got_syms.push_back(sym);
 }
 
 void GotSection::add_gottpoff_symbol(Symbol *sym) {
-  assert(sym->gottpoff_idx == -1);
-  sym->gottpoff_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->aux().gottpoff_idx == -1);
+  sym->alloc_aux().gottpoff_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE;
   gottpoff_syms.push_back(sym);
 }
 
 void GotSection::add_tlsgd_symbol(Symbol *sym) {
-  assert(sym->tlsgd_idx == -1);
-  sym->tlsgd_idx = shdr.sh_size / GOT_SIZE;
+  assert(sym->aux().tlsgd_idx == -1);
+  sym->alloc_aux().tlsgd_idx = shdr.sh_size / GOT_SIZE;
   shdr.sh_size += GOT_SIZE * 2;
   tlsgd_syms.push_back(sym);
 }
@@ -472,11 +482,11 @@ void GotSection::copy_buf() {
 
   for (Symbol *sym : got_syms)
     if (!sym->is_imported)
-      buf[sym->got_idx] = sym->get_addr();
+      buf[sym->aux().got_idx] = sym->get_addr();
 
   for (Symbol *sym : gottpoff_syms)
     if (!sym->is_imported)
-      buf[sym->gottpoff_idx] = sym->get_addr() - out::tls_end;
+      buf[sym->aux().gottpoff_idx] = sym->get_addr() - out::tls_end;
 }
 
 void GotPltSection::copy_buf() {
@@ -487,18 +497,18 @@ void GotPltSection::copy_buf() {
   buf[2] = 0;
 
   for (Symbol *sym : out::plt->symbols)
-    if (sym->gotplt_idx != -1)
-      buf[sym->gotplt_idx] = sym->get_plt_addr() + 6;
+    if (sym->aux().gotplt_idx != -1)
+      buf[sym->aux().gotplt_idx] = sym->get_plt_addr() + 6;
 }
 
 void PltSection::add_symbol(Symbol *sym) {
-  assert(sym->plt_idx == -1);
-  sym->plt_idx = shdr.sh_size / PLT_SIZE;
+  assert(sym->aux().plt_idx == -1);
+  sym->alloc_aux().plt_idx = shdr.sh_size / PLT_SIZE;
   shdr.sh_size += PLT_SIZE;
   symbols.push_back(sym);
 
-  if (sym->got_idx == -1) {
-    sym->gotplt_idx = out::gotplt->shdr.sh_size / GOT_SIZE;
+  if (sym->aux().got_idx == -1) {
+    sym->alloc_aux().gotplt_idx = out::gotplt->shdr.sh_size / GOT_SIZE;
     out::gotplt->shdr.sh_size += GOT_SIZE;
 
     sym->has_relplt = true;
@@ -524,9 +534,9 @@ void PltSection::copy_buf() {
   int relplt_idx = 0;
 
   for (Symbol *sym : symbols) {
-    u8 *ent = buf + sym->plt_idx * PLT_SIZE;
+    u8 *ent = buf + sym->aux().plt_idx * PLT_SIZE;
 
-    if (sym->gotplt_idx != -1) {
+    if (sym->aux().gotplt_idx != -1) {
       const u8 data[] = {
         0xff, 0x25, 0, 0, 0, 0, // jmp   *foo@GOTPLT
         0x68, 0,    0, 0, 0,    // push  $index_in_relplt
@@ -565,7 +575,7 @@ void RelPltSection::copy_buf() {
 
     ElfRela &rel = buf[relplt_idx++];
     memset(&rel, 0, sizeof(rel));
-    rel.r_sym = sym->dynsym_idx;
+    rel.r_sym = sym->aux().dynsym_idx;
     rel.r_offset = sym->get_gotplt_addr();
 
     if (sym->st_type == STT_GNU_IFUNC) {
@@ -578,23 +588,63 @@ void RelPltSection::copy_buf() {
 }
 
 void DynsymSection::add_symbol(Symbol *sym) {
-  if (sym->dynsym_idx != -1)
+  if (sym->aux().dynsym_idx != -1)
     return;
-  sym->dynsym_idx = -2;
+  sym->alloc_aux().dynsym_idx = -2;
   symbols.push_back(sym);
   name_indices.push_back(out::dynstr->add_string(sym->name));
 }
 
 void DynsymSection::sort_symbols() {
+  Timer t("sort_dynsyms");
+
+  struct T {
+    Symbol *sym;
+    u32 name_idx;
+    u32 hash;
+  };
+
+  std::vector<T> vec(symbols.size());
+  for (int i = 0; i < symbols.size(); i++)
+    vec[i] = {symbols[i], name_indices[i], 0};
+
+  // In any ELF file, local symbols should precede global symbols.
   auto first_global = std::stable_partition(
-    symbols.begin(), symbols.end(),
-    [](Symbol *sym) { return sym->esym->st_bind == STB_LOCAL; });
+    vec.begin(), vec.end(),
+    [](const T &x) { return x.sym->esym->st_bind == STB_LOCAL; });
+
+  // .gnu.hash only contains symbols defined by this module, and they
+  // have to be at the end of .dynsym sorted by their hash buckets.
+  auto first_exported = std::stable_partition(
+    first_global, vec.end(),
+    [](const T &x) { return x.sym->is_imported || x.sym->esym->is_undef(); });
+
+  if (out::gnu_hash) {
+    int num_exported = vec.end() - first_exported;
+    u32 num_buckets = num_exported / GnuHashSection::LOAD_FACTOR + 1;
+
+    tbb::parallel_for(0, num_exported, [&](int i) {
+      first_exported[i].hash = gnu_hash(first_exported[i].sym->name);
+    });
+
+    std::stable_sort(first_exported, vec.end(), [&](const T &a, const T &b) {
+      return a.hash % num_buckets < b.hash % num_buckets;
+    });
+
+    out::gnu_hash->num_buckets = num_buckets;
+    out::gnu_hash->symoffset = first_exported - vec.begin() + 1;
+    out::gnu_hash->hashes.resize(num_exported);
+    for (int i = 0; i < num_exported; i++)
+      out::gnu_hash->hashes[i] = first_exported[i].hash;
+  }
 
-  shdr.sh_info = first_global - symbols.begin() + 1;
+  shdr.sh_info = first_global - vec.begin() + 1;
 
-  int i = 1;
-  for (Symbol *sym : symbols)
-    sym->dynsym_idx = i++;
+  for (int i = 0; i < vec.size(); i++) {
+    symbols[i] = vec[i].sym;
+    name_indices[i] = vec[i].name_idx;
+    symbols[i]->alloc_aux().dynsym_idx = i + 1;
+  }
 }
 
 void DynsymSection::update_shdr() {
@@ -609,7 +659,7 @@ void DynsymSection::copy_buf() {
   for (int i = 0; i < symbols.size(); i++) {
     Symbol &sym = *symbols[i];
 
-    ElfSym &esym = *(ElfSym *)(base + sym.dynsym_idx * sizeof(ElfSym));
+    ElfSym &esym = *(ElfSym *)(base + sym.aux().dynsym_idx * sizeof(ElfSym));
     memset(&esym, 0, sizeof(esym));
     esym.st_name = name_indices[i];
     esym.st_type = sym.st_type;
@@ -652,22 +702,86 @@ void HashSection::copy_buf() {
 
   hdr[0] = hdr[1] = num_slots;
 
-  for (Symbol *sym : out::dynsym->symbols) {
-    u32 i = elf_hash(sym->name) % num_slots;
-    chains[sym->dynsym_idx] = buckets[i];
-    buckets[i] = sym->dynsym_idx;
+  std::vector<Symbol *> &syms = out::dynsym->symbols;
+  std::vector<u32> hashes(syms.size());
+
+  tbb::parallel_for(0, (int)syms.size(), [&](int i) {
+    hashes[i] = elf_hash(syms[i]->name) % num_slots;
+  });
+
+  for (int i = 0; i < syms.size(); i++) {
+    chains[syms[i]->aux().dynsym_idx] = buckets[hashes[i]];
+    buckets[hashes[i]] = syms[i]->aux().dynsym_idx;
   }
 }
 
+void GnuHashSection::update_shdr() {
+  shdr.sh_link = out::dynsym->shndx;
+
+  // We allocate 12 bits per symbol in the bloom filter. The number
+  // of bloom words has to be a power of two.
+  u32 num_bits = hashes.size() * 12;
+  num_bloom = 1;
+  while (num_bloom * ELFCLASS_BITS < num_bits)
+    num_bloom *= 2;
+
+  shdr.sh_size = HEADER_SIZE + num_bloom * 8 + num_buckets * 4 +
+                 hashes.size() * 4;
+}
+
+void GnuHashSection::copy_buf() {
+  u8 *base = out::buf + shdr.sh_offset;
+  memset(base, 0, shdr.sh_size);
+
+  u32 *hdr = (u32 *)base;
+  u64 *bloom = (u64 *)(base + HEADER_SIZE);
+  u32 *buckets = (u32 *)(bloom + num_bloom);
+  u32 *table = buckets + num_buckets;
+  int num_exported = hashes.size();
+
+  hdr[0] = num_buckets;
+  hdr[1] = symoffset;
+  hdr[2] = num_bloom;
+  hdr[3] = BLOOM_SHIFT;
+
+  // Set bloom filter bits
+  tbb::parallel_for(0, num_exported, [&](int i) {
+    u32 h = hashes[i];
+    u32 idx = (h / ELFCLASS_BITS) % num_bloom;
+    u64 bits = ((u64)1 << (h % ELFCLASS_BITS)) |
+               ((u64)1 << ((h >> BLOOM_SHIFT) % ELFCLASS_BITS));
+    std::atomic_ref(bloom[idx]).fetch_or(bits, std::memory_order_relaxed);
+  });
+
+  // Write hash buckets and chains. Symbols are sorted by bucket,
+  // so each bucket points to the first symbol of a run, and the last
+  // symbol of each run has the lowest bit set.
+  tbb::parallel_for(0, num_exported, [&](int i) {
+    u32 bucket = hashes[i] % num_buckets;
+
+    if (i == 0 || hashes[i - 1] % num_buckets != bucket)
+      buckets[bucket] = i + symoffset;
+
+    table[i] = hashes[i] & ~1;
+    if (i == num_exported - 1 || hashes[i + 1] % num_buckets != bucket)
+      table[i] |= 1;
+  });
+}
+
 MergedSection *
-MergedSection::get_instance(std::string_view name, u32 type, u64 flags) {
+MergedSection::get_instance(std::string_view name, u32 type, u64 flags,
+                            u32 entsize) {
   name = get_output_name(name);
+  bool is_string = (flags & SHF_STRINGS);
   flags = flags & ~(u64)SHF_MERGE & ~(u64)SHF_STRINGS;
 
+  // Sections with different entry sizes are not merged with each
+  // other, as pieces of different sizes have different alignments.
   auto find = [&]() -> MergedSection * {
     for (MergedSection *osec : MergedSection::instances)
       if (name == osec->name && flags == osec->shdr.sh_flags &&
-          type == osec->shdr.sh_type)
+          type == osec->shdr.sh_type && entsize == osec->entsize &&
+          is_string == osec->is_string)
         return osec;
     return nullptr;
   };
@@ -685,42 +799,210 @@ MergedSection::get_instance(std::string_view name, u32 type, u64 flags) {
   if (MergedSection *osec = find())
     return osec;
 
-  auto *osec = new MergedSection(name, flags, type);
-  MergedSection::instances.push_back(osec);
-  return osec;
+  return new MergedSection(name, flags, type, entsize, is_string);
 }
 
 void MergedSection::copy_buf() {
   u8 *base = out::buf + shdr.sh_offset;
 
-  map.for_each_value([&](const StringPiece &piece) {
-    if (MergeableSection *m = piece.isec)
-      memcpy(base + m->offset + piece.output_offset, piece.data, piece.size);
+  // Each piece is copied by the member that owns it, so the members
+  // can be copied in parallel.
+  tbb::parallel_for_each(members, [&](MergeableSection *m) {
+    u8 *buf = base + m->offset;
+    for (StringPiece *piece : m->pieces)
+      if (piece->isec == m)
+        memcpy(buf + piece->output_offset, piece->data, piece->size);
   });
 }
 
-void EhFrameSection::finalize_contents() {
-  for (int i = 0; i < members.size(); i++) {
-    InputSection &isec = *members[i];
-    if (isec.shdr.sh_type == SHT_NOBITS || isec.shdr.sh_size == 0)
-      return;
+void EhFrameSection::construct() {
+  Timer t("eh_frame");
+
+  // Remove FDEs pointing to dead sections.
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    for (FdeRecord &fde : file->fdes)
+      fde.is_alive = false;
+
+    for (InputSection *isec : file->sections)
+      if (isec && isec->is_alive)
+        for (int i = isec->fde_begin; i < isec->fde_end; i++)
+          file->fdes[i].is_alive = true;
+  });
 
-    contents[i].resize(isec.shdr.sh_size);
-    u8 *buf = contents[i].data();
+  // Deduplicate CIEs. The number of distinct CIEs is usually very
+  // small, so we do this serially to make the output deterministic.
+  std::unordered_map<std::string_view, std::vector<CieRecord *>> leaders;
 
-    isec.copy_contents(buf);
-    isec.apply_reloc_alloc(buf);
+  for (ObjectFile *file : out::objs) {
+    for (CieRecord &cie : file->cies) {
+      std::vector<CieRecord *> &vec = leaders[cie.contents];
+      for (CieRecord *leader : vec) {
+        if (cie.should_merge(*leader)) {
+          cie.leader = leader;
+          break;
+        }
+      }
+
+      if (!cie.leader) {
+        cie.leader = &cie;
+        vec.push_back(&cie);
+      }
+    }
   }
+
+  // Assign offsets within each file.
+  tbb::parallel_for_each(out::objs, [](ObjectFile *file) {
+    u64 offset = 0;
+
+    for (CieRecord &cie : file->cies) {
+      if (cie.leader == &cie) {
+        cie.output_offset = offset;
+        offset += cie.contents.size();
+      }
+    }
+
+    for (FdeRecord &fde : file->fdes) {
+      if (fde.is_alive) {
+        fde.output_offset = offset;
+        offset += fde.contents.size();
+      }
+    }
+
+    file->ehframe_size = offset;
+  });
+
+  // Assign offsets to files.
+  static Counter counter("removed_fdes");
+  u64 offset = 0;
+  num_fdes = 0;
+
+  for (ObjectFile *file : out::objs) {
+    file->ehframe_offset = offset;
+    file->fde_idx = num_fdes;
+    offset += file->ehframe_size;
+
+    for (FdeRecord &fde : file->fdes) {
+      if (fde.is_alive)
+        num_fdes++;
+      else
+        counter.inc();
+    }
+  }
+
+  // .eh_frame is terminated by a zero-length record.
+  shdr.sh_size = offset ? offset + 4 : 0;
+}
+
+static void apply_ehframe_reloc(ObjectFile *file, const ElfRela &rel,
+                                u64 offset, u64 val) {
+  u8 *loc = out::buf + out::eh_frame->shdr.sh_offset + offset;
+  u64 addr = out::eh_frame->shdr.sh_addr + offset;
+
+  switch (rel.r_type) {
+  case R_X86_64_NONE:
+    return;
+  case R_X86_64_32:
+    *(u32 *)loc = val;
+    return;
+  case R_X86_64_64:
+    *(u64 *)loc = val;
+    return;
+  case R_X86_64_PC32:
+    *(u32 *)loc = val - addr;
+    return;
+  case R_X86_64_PC64:
+    *(u64 *)loc = val - addr;
+    return;
+  }
+  Fatal() << *file << ": unsupported relocation in .eh_frame: " << rel.r_type;
 }
 
 void EhFrameSection::copy_buf() {
   u8 *base = out::buf + shdr.sh_offset;
-  u64 offset = 0;
 
-  for (std::span<u8> buf : contents) {
-    memcpy(base + offset, buf.data(), buf.size());
-    offset += contents.size();
-  }
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    auto copy = [&](std::string_view contents, std::span<ElfRela> rels,
+                    u32 input_offset, u64 output_offset) {
+      memcpy(base + output_offset, contents.data(), contents.size());
+
+      for (const ElfRela &rel : rels) {
+        Symbol &sym = *file->symbols[rel.r_sym];
+        u64 offset = output_offset + rel.r_offset - input_offset;
+        apply_ehframe_reloc(file, rel, offset, sym.get_addr() + rel.r_addend);
+      }
+    };
+
+    for (CieRecord &cie : file->cies)
+      if (cie.leader == &cie)
+        copy(cie.contents, cie.rels, cie.input_offset,
+             file->ehframe_offset + cie.output_offset);
+
+    for (FdeRecord &fde : file->fdes) {
+      if (!fde.is_alive)
+        continue;
+
+      u64 offset = file->ehframe_offset + fde.output_offset;
+      copy(fde.contents, fde.rels, fde.input_offset, offset);
+
+      // Rewrite the CIE pointer, which is an offset from this field
+      // to the beginning of the CIE.
+      CieRecord &cie = *file->cies[fde.cie_idx].leader;
+      u64 cie_offset = cie.file->ehframe_offset + cie.output_offset;
+      *(u32 *)(base + offset + 4) = offset + 4 - cie_offset;
+    }
+  });
+
+  *(u32 *)(base + shdr.sh_size - 4) = 0;
+}
+
+void EhFrameHdrSection::update_shdr() {
+  if (out::eh_frame->shdr.sh_size == 0)
+    shdr.sh_size = 0;
+  else
+    shdr.sh_size = HEADER_SIZE + out::eh_frame->num_fdes * 8;
+}
+
+void EhFrameHdrSection::copy_buf() {
+  u8 *base = out::buf + shdr.sh_offset;
+  u32 num_fdes = out::eh_frame->num_fdes;
+
+  base[0] = 1;
+  base[1] = DW_EH_PE_pcrel | DW_EH_PE_sdata4;
+  base[2] = DW_EH_PE_udata4;
+  base[3] = DW_EH_PE_datarel | DW_EH_PE_sdata4;
+  *(u32 *)(base + 4) = out::eh_frame->shdr.sh_addr - shdr.sh_addr - 4;
+  *(u32 *)(base + 8) = num_fdes;
+
+  struct Entry {
+    i32 init_addr;
+    i32 fde_addr;
+  };
+
+  // Create a binary search table of (function address, FDE address)
+  // pairs. Both addresses are relative to .eh_frame_hdr.
+  Entry *entries = (Entry *)(base + HEADER_SIZE);
+
+  tbb::parallel_for_each(out::objs, [&](ObjectFile *file) {
+    Entry *ent = entries + file->fde_idx;
+
+    for (FdeRecord &fde : file->fdes) {
+      if (!fde.is_alive)
+        continue;
+
+      const ElfRela &rel = fde.rels[0];
+      u64 init_addr = file->symbols[rel.r_sym]->get_addr() + rel.r_addend;
+      u64 fde_addr = out::eh_frame->shdr.sh_addr + file->ehframe_offset +
+                     fde.output_offset;
+
+      ent->init_addr = init_addr - shdr.sh_addr;
+      ent->fde_addr = fde_addr - shdr.sh_addr;
+      ent++;
+    }
+  });
+
+  tbb::parallel_sort(entries, entries + num_fdes, [](const Entry &a, const Entry &b) {
+    return a.init_addr < b.init_addr;
+  });
 }
 
 void CopyrelSection::add_symbol(Symbol *sym) {
@@ -778,3 +1060,92 @@ void BuildIdSection::write_buildid(u64 filesize) {
 
   SHA256((u8 *)shards, sizeof(shards), out::buf + shdr.sh_offset + 16);
 }
+
+// Compress a shard as a raw deflate stream. All but the last shard
+// end with a sync flush, so that the outputs are byte-aligned and
+// can be concatenated to form a single stream.
+static std::vector<u8> deflate_shard(std::span<u8> in, bool is_last) {
+  z_stream strm = {};
+  if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK)
+    Fatal() << "deflateInit2 failed";
+
+  std::vector<u8> out(deflateBound(&strm, in.size()) + 16);
+  strm.next_in = in.data();
+  strm.avail_in = in.size();
+  strm.next_out = out.data();
+  strm.avail_out = out.size();
+
+  int ret = deflate(&strm, is_last ? Z_FINISH : Z_SYNC_FLUSH);
+  if (ret != (is_last ? Z_STREAM_END : Z_OK) || strm.avail_in)
+    Fatal() << "deflate failed";
+
+  out.resize(strm.total_out);
+  deflateEnd(&strm);
+  return out;
+}
+
+CompressedSection::CompressedSection(OutputChunk &chunk, std::span<u8> contents)
+  : OutputChunk(SYNTHETIC) {
+  static Counter in_bytes("compress_in_bytes");
+  static Counter out_bytes("compress_out_bytes");
+
+  name = chunk.name;
+  shndx = chunk.shndx;
+  shdr = chunk.shdr;
+  shdr.sh_flags |= SHF_COMPRESSED;
+  shdr.sh_addralign = 8;
+
+  chdr.ch_type = ELFCOMPRESS_ZLIB;
+  chdr.ch_size = contents.size();
+  chdr.ch_addralign = chunk.shdr.sh_addralign;
+
+  i64 shard_size = 1024 * 1024;
+  i64 num_shards = contents.size() / shard_size + 1;
+  std::vector<u32> adlers(num_shards);
+  shards.resize(num_shards);
+
+  tbb::parallel_for((i64)0, num_shards, [&](i64 i) {
+    std::span<u8> in = contents.subspan(shard_size * i);
+    if (in.size() > shard_size)
+      in = in.subspan(0, shard_size);
+    shards[i] = deflate_shard(in, i == num_shards - 1);
+    adlers[i] = adler32(1, in.data(), in.size());
+  });
+
+  // Combine per-shard checksums into the checksum of the whole data.
+  checksum = adlers[0];
+  for (i64 i = 1; i < num_shards; i++) {
+    i64 size = std::min<i64>(shard_size, contents.size() - shard_size * i);
+    checksum = adler32_combine(checksum, adlers[i], size);
+  }
+
+  // A compressed section consists of a Chdr, a 2-byte zlib header,
+  // deflate shards and a 4-byte big-endian Adler-32 checksum.
+  u64 offset = sizeof(ElfChdr) + 2;
+  for (std::vector<u8> &shard : shards) {
+    shard_offsets.push_back(offset);
+    offset += shard.size();
+  }
+  shdr.sh_size = offset + 4;
+
+  in_bytes.inc(contents.size());
+  out_bytes.inc(shdr.sh_size);
+}
+
+void CompressedSection::copy_buf() {
+  u8 *base = out::buf + shdr.sh_offset;
+  memcpy(base, &chdr, sizeof(chdr));
+  base[sizeof(chdr)] = 0x78;
+  base[sizeof(chdr) + 1] = 0x9c;
+
+  tbb::parallel_for(0, (int)shards.size(), [&](int i) {
+    memcpy(base + shard_offsets[i], shards[i].data(), shards[i].size());
+  });
+
+  u8 *end = base + shdr.sh_size;
+  end[-4] = checksum >> 24;
+  end[-3] = checksum >> 16;
+  end[-2] = checksum >> 8;
+  end[-1] = checksum;
+}
@@ -1,13 +1,15 @@
 #include "mold.h"
 
+#include <limits.h>
 #include <openssl/sha.h>
+#include <signal.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/un.h>
 #include <unistd.h>
-
-#define DAEMON_TIMEOUT 30
+#include <unordered_map>
 
 // Exiting from a program with large memory usage is slow --
 // it may take a few hundred milliseconds. To hide the latency,
@@ -61,17 +63,95 @@ static std::string base64(u8 *data, u64 size) {
   return out.str();
 }
 
-static std::string compute_sha256(char **argv) {
-  SHA256_CTX ctx;
-  SHA256_Init(&ctx);
+// All link commands run by the same user with the same mold executable
+// share one daemon, so the socket name is derived from them.
+static std::string get_socket_path() {
+  std::string key = std::to_string(getuid()) + ":";
 
-  for (int i = 0; argv[i]; i++)
-    if (!strcmp(argv[i], "-preload") && !strcmp(argv[i], "--preload"))
-      SHA256_Update(&ctx, argv[i], strlen(argv[i]) + 1);
+  char buf[PATH_MAX];
+  ssize_t len = readlink("/proc/self/exe", buf, sizeof(buf));
+  if (len > 0)
+    key += std::string(buf, len);
 
   u8 digest[SHA256_SIZE];
-  SHA256_Final(digest, &ctx);
-  return base64(digest, SHA256_SIZE);
+  SHA256((u8 *)key.data(), key.size(), digest);
+  return "/tmp/mold-" + base64(digest, SHA256_SIZE);
+}
+
+static void write_full(int fd, const void *buf, u64 size) {
+  while (size > 0) {
+    ssize_t n = write(fd, buf, size);
+    if (n <= 0)
+      Fatal() << "write failed: " << strerror(errno);
+    buf = (char *)buf + n;
+    size -= n;
+  }
+}
+
+static bool read_full(int fd, void *buf, u64 size) {
+  while (size > 0) {
+    ssize_t n = read(fd, buf, size);
+    if (n <= 0)
+      return false;
+    buf = (char *)buf + n;
+    size -= n;
+  }
+  return true;
+}
+
+// A link request consists of the client's working directory and
+// command line arguments, each terminated by NUL.
+static void send_request(int conn, char **argv) {
+  char cwd[PATH_MAX];
+  if (!getcwd(cwd, sizeof(cwd)))
+    Fatal() << "getcwd failed: " << strerror(errno);
+
+  std::string buf = std::string(cwd) + '\0';
+  for (int i = 0; argv[i]; i++)
+    buf += std::string(argv[i]) + '\0';
+
+  u32 size = buf.size();
+  write_full(conn, &size, sizeof(size));
+  write_full(conn, buf.data(), size);
+}
+
+// Returns null if a request is malformed, so that a broken client
+// doesn't take down the daemon.
+static char **recv_request(int conn, char **cwd) {
+  static constexpr u32 MAX_REQUEST_SIZE = 64 * 1024 * 1024;
+
+  u32 size;
+  if (!read_full(conn, &size, sizeof(size)))
+    return nullptr;
+  if (size == 0 || size > MAX_REQUEST_SIZE)
+    return nullptr;
+
+  char *buf = new char[size];
+  if (!read_full(conn, buf, size) || buf[size - 1] != '\0') {
+    delete[] buf;
+    return nullptr;
+  }
+
+  std::vector<char *> vec;
+  for (char *p = buf; p < buf + size; p += strlen(p) + 1)
+    vec.push_back(p);
+
+  // A request must have a working directory and at least argv[0].
+  if (vec.size() < 2) {
+    delete[] buf;
+    return nullptr;
+  }
+
+  *cwd = vec[0];
+  char **argv = new char *[vec.size()];
+  std::copy(vec.begin() + 1, vec.end(), argv);
+  argv[vec.size() - 1] = nullptr;
+  return argv;
+}
+
+static void free_request(char **argv, char *cwd) {
+  delete[] cwd;
+  delete[] argv;
 }
 
 static void send_fd(int conn, int fd) {
@@ -114,10 +194,12 @@ static int recv_fd(int conn) {
 
   int len = recvmsg(conn, &msg, 0);
   if (len <= 0)
-    Error() << "recvmsg failed: " << strerror(errno);
+    return -1;
 
-  struct cmsghdr *cmsg;
-  cmsg = CMSG_FIRSTHDR(&msg);
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+    return -1;
   return *(int *)CMSG_DATA(cmsg);
 }
 
@@ -126,7 +208,7 @@ bool resume_daemon(char **argv, int *code) {
   if (conn == -1)
     Error() << "socket failed: " << strerror(errno);
 
-  std::string path = "/tmp/mold-" + compute_sha256(argv);
+  std::string path = get_socket_path();
 
   struct sockaddr_un name = {};
   name.sun_family = AF_UNIX;
@@ -139,13 +221,146 @@ bool resume_daemon(char **argv, int *code) {
 
   send_fd(conn, STDOUT_FILENO);
   send_fd(conn, STDERR_FILENO);
+  send_request(conn, argv);
+
   int r = read(conn, (char[1]){}, 1);
   *code = (r != 1);
   return true;
 }
 
-void daemonize(char **argv, std::function<void()> *wait_for_client,
-               std::function<void()> *on_complete) {
+// The daemon watches directories containing its input files, so that
+// it can re-parse files as soon as they are rewritten by a compiler.
+// We watch directories rather than files because compilers may
+// replace files by renaming new ones over them.
+static int inotify_fd = -1;
+static std::unordered_map<int, std::string> watched_dirs;
+static std::unordered_map<std::string, std::string> watched_files;
+
+static std::string get_realpath(std::string path) {
+  char *real = realpath(path.c_str(), nullptr);
+  if (!real)
+    return "";
+  std::string ret = real;
+  free(real);
+  return ret;
+}
+
+// Watches a file. If the file is modified, `target` is passed to the
+// reload callback. `target` is usually the file itself, but it is the
+// archive file for a member of a thin archive.
+void watch_file(std::string path, std::string target) {
+  if (inotify_fd == -1)
+    return;
+
+  path = get_realpath(path);
+  target = get_realpath(target);
+  if (path.empty() || target.empty() || watched_files.contains(path))
+    return;
+  watched_files[path] = target;
+
+  std::string dir = path.substr(0, path.rfind('/'));
+  int wd = inotify_add_watch(inotify_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (wd != -1)
+    watched_dirs[wd] = dir;
+}
+
+// Returns reload targets of watched files that have been rewritten.
+static std::vector<std::string> read_inotify_events() {
+  alignas(struct inotify_event) char buf[4096];
+  std::vector<std::string> paths;
+
+  for (;;) {
+    ssize_t len = read(inotify_fd, buf, sizeof(buf));
+    if (len <= 0)
+      break;
+
+    for (char *p = buf; p < buf + len;) {
+      struct inotify_event *event = (struct inotify_event *)p;
+      p += sizeof(struct inotify_event) + event->len;
+
+      if (event->len == 0 || !watched_dirs.contains(event->wd))
+        continue;
+
+      std::string path = watched_dirs[event->wd] + "/" + event->name;
+      if (auto it = watched_files.find(path); it != watched_files.end())
+        paths.push_back(it->second);
+    }
+  }
+
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  return paths;
+}
+
+// Runs a function in a child process and returns true if it finishes
+// without errors. The daemon uses this to test-run requests before
+// running them in its own process, because any error in parsing
+// command line options or input files would terminate the daemon.
+static bool run_in_child(int sock, std::function<void()> fn) {
+  int pipefd[2];
+  if (pipe(pipefd) == -1)
+    return false;
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    close(pipefd[0]);
+    close(pipefd[1]);
+    return false;
+  }
+
+  if (pid == 0) {
+    // Child
+    close(pipefd[0]);
+    close(sock);
+    if (inotify_fd != -1)
+      close(inotify_fd);
+    inotify_fd = -1;
+    socket_tmpfile = nullptr;
+
+    fn();
+    write(pipefd[1], (char []){1}, 1);
+    _exit(0);
+  }
+
+  // Parent. Children are reaped automatically because SIGCHLD is
+  // ignored, so we wait for the result through a pipe instead.
+  close(pipefd[1]);
+  int r;
+  do {
+    r = read(pipefd[0], (char[1]){}, 1);
+  } while (r == -1 && errno == EINTR);
+  close(pipefd[0]);
+  return r == 1;
+}
+
+static constexpr i64 MAX_RELOADED_FILES = 1000;
+
+static u64 now_sec() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec;
+}
+
+// Turns the current process into a long-lived server. The server keeps
+// parsed input files in memory and forks a child for each link request,
+// so that the child can use the parsed files without affecting the
+// server's state. This function returns only in the children with the
+// client's command line arguments.
+//
+// The server exits if it doesn't receive any request for
+// --daemon-timeout seconds.
+char **daemonize(char **argv, std::function<void(char **)> preload,
+                 std::function<void(std::span<std::string>)> reload,
+                 std::function<void()> *on_complete) {
+  // config is overwritten by requests, so save the value now.
+  int timeout = config.daemon_timeout;
+
+  // Requests change the current directory. We need the original one
+  // to re-execute ourselves with the same arguments.
+  char *orig_cwd = getcwd(nullptr, 0);
+  if (!orig_cwd)
+    Error() << "getcwd failed: " << strerror(errno);
+
   if (daemon(1, 0) == -1)
     Error() << "daemon failed: " << strerror(errno);
 
@@ -153,7 +368,7 @@ void daemonize(char **argv, std::function<void()> *wait_for_client,
   if (sock == -1)
     Error() << "socket failed: " << strerror(errno);
 
-  socket_tmpfile = strdup(("/tmp/mold-" + compute_sha256(argv)).c_str());
+  socket_tmpfile = strdup(get_socket_path().c_str());
 
   struct sockaddr_un name = {};
   name.sun_family = AF_UNIX;
@@ -172,37 +387,147 @@ void daemonize(char **argv, std::function<void()> *wait_for_client,
 
   umask(orig_mask);
 
-  if (listen(sock, 0) == -1)
+  // Another daemon may take over the socket path later. We remember
+  // the inode so that we don't remove other daemon's socket on exit.
+  struct stat st;
+  if (stat(socket_tmpfile, &st) == -1)
+    Error() << "stat failed: " << strerror(errno);
+  ino_t socket_ino = st.st_ino;
+
+  if (listen(sock, SOMAXCONN) == -1)
     Error() << "listen failed: " << strerror(errno);
 
-  static int conn = -1;
+  // Children are not waited for.
+  signal(SIGCHLD, SIG_IGN);
+
+  inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  MemoryMappedFile::read_into_memory = true;
+
+  preload(argv);
 
-  *wait_for_client = [=]() {
+  u64 deadline = now_sec() + timeout;
+  i64 num_reloaded = 0;
+
+  for (;;) {
     fd_set rfds;
     FD_ZERO(&rfds);
     FD_SET(sock, &rfds);
-
-    struct timeval tv;
-    tv.tv_sec = DAEMON_TIMEOUT;
-    tv.tv_usec = 0;
-
-    int res = select(sock + 1, &rfds, NULL, NULL, &tv);
-    if (res == -1)
+    if (inotify_fd != -1)
+      FD_SET(inotify_fd, &rfds);
+
+    struct timeval tv = {};
+    u64 now = now_sec();
+    if (deadline > now)
+      tv.tv_sec = deadline - now;
+
+    int res = select(std::max(sock, inotify_fd) + 1, &rfds, NULL, NULL,
+                     timeout ? &tv : NULL);
+    if (res == -1) {
+      if (errno == EINTR)
+        continue;
       Error() << "select failed: " << strerror(errno);
+    }
 
     if (res == 0) {
       std::cout << "timeout\n";
+      if (stat(socket_tmpfile, &st) == -1 || st.st_ino != socket_ino)
+        socket_tmpfile = nullptr;
+      cleanup();
       exit(0);
     }
 
-    conn = accept(sock, NULL, NULL);
+    // Re-parse rewritten files before the next link request arrives.
+    // A file may be half-written or corrupted, so each batch is test-run
+    // in a child first. If that fails, files are tried one by one, and
+    // the ones that fail are left to be parsed by the link itself.
+    if (inotify_fd != -1 && FD_ISSET(inotify_fd, &rfds)) {
+      std::vector<std::string> paths = read_inotify_events();
+      if (!paths.empty()) {
+        if (run_in_child(sock, [&]() { reload(paths); })) {
+          reload(paths);
+          num_reloaded += paths.size();
+        } else {
+          for (std::string &path : paths) {
+            std::span<std::string> one(&path, 1);
+            if (run_in_child(sock, [&]() { reload(one); })) {
+              reload(one);
+              num_reloaded++;
+            }
+          }
+        }
+      }
+
+      // Files replaced by reloads are never freed. To bound memory
+      // usage, we start over with a new process once we have reloaded
+      // many files.
+      if (num_reloaded >= MAX_RELOADED_FILES) {
+        close(sock);
+        close(inotify_fd);
+        if (stat(socket_tmpfile, &st) == 0 && st.st_ino == socket_ino)
+          unlink(socket_tmpfile);
+        if (chdir(orig_cwd) == 0)
+          execv("/proc/self/exe", argv);
+        _exit(0);
+      }
+    }
+
+    if (!FD_ISSET(sock, &rfds))
+      continue;
+
+    deadline = now_sec() + timeout;
+
+    int conn = accept(sock, NULL, NULL);
     if (conn == -1)
-      Error() << "accept failed: " << strerror(errno);
-    unlink(socket_tmpfile);
+      continue;
+
+    // A client may disconnect or send garbage at any time. Such a
+    // connection is dropped without affecting the daemon.
+    int out = recv_fd(conn);
+    int err = (out == -1) ? -1 : recv_fd(conn);
+    char *cwd;
+    char **args = (err == -1) ? nullptr : recv_request(conn, &cwd);
+
+    if (!args) {
+      if (out != -1)
+        close(out);
+      if (err != -1)
+        close(err);
+      close(conn);
+      continue;
+    }
 
-    dup2(recv_fd(conn), STDOUT_FILENO);
-    dup2(recv_fd(conn), STDERR_FILENO);
-  };
+    pid_t pid = fork();
+    if (pid == -1)
+      Error() << "fork failed: " << strerror(errno);
+
+    if (pid == 0) {
+      // Child
+      close(sock);
+      close(inotify_fd);
+      socket_tmpfile = nullptr;
+      MemoryMappedFile::read_into_memory = false;
+      signal(SIGCHLD, SIG_DFL);
+
+      dup2(out, STDOUT_FILENO);
+      dup2(err, STDERR_FILENO);
+      close(out);
+      close(err);
 
-  *on_complete = [=]() { write(conn, (char []){1}, 1); };
+      if (chdir(cwd) == -1)
+        Fatal() << "chdir failed: " << cwd << ": " << strerror(errno);
+
+      *on_complete = [=]() { write(conn, (char []){1}, 1); };
+      return args;
+    }
+
+    // Parent. Parse the input files of the request in advance,
+    // so that subsequent requests can reuse them.
+    close(conn);
+    close(out);
+    close(err);
+
+    if (chdir(cwd) == 0 && run_in_child(sock, [&]() { preload(args); }))
+      preload(args);
+    free_request(args, cwd);
+  }
 }
@@ -0,0 +1,79 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+int three() { return 3; }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+int five() { return 5; }
+EOF
+
+cat <<EOF | cc -o $t/c.o -c -xc -
+#include <stdio.h>
+int three();
+int main() { printf("%d\n", three()); }
+EOF
+
+link() {
+  ../mold --trace -stat -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    $t/c.o "$@" \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o > $t/log
+}
+
+# Members are read lazily using the archive symbol table.
+rm -f $t/d.a
+(cd $t; ar rcs d.a a.o b.o)
+
+link $t/d.a
+grep -q 'lazy_members=[1-9]' $t/log
+grep -q 'skipped_members=[1-9]' $t/log
+fgrep -q 'archive-lazy/d.a:(a.o)' $t/log
+! fgrep -q 'archive-lazy/d.a:(b.o)' $t/log || false
+$t/exe | grep -q 3
+
+# Without an archive symbol table, members' own symbol tables are
+# read first, and the rest is parsed only if they are pulled out.
+rm -f $t/e.a
+(cd $t; ar rcS e.a a.o b.o)
+
+link $t/e.a
+grep -q 'skipped_members=[1-9]' $t/log
+fgrep -q 'archive-lazy/e.a:(a.o)' $t/log
+! fgrep -q 'archive-lazy/e.a:(b.o)' $t/log || false
+$t/exe | grep -q 3
+
+# Thin archive members are not even opened unless they are pulled out.
+rm -f $t/f.a
+cp $t/b.o $t/unused.o
+(cd $t; ar rcsT f.a a.o unused.o)
+rm $t/unused.o
+
+link $t/f.a
+$t/exe | grep -q 3
+
+# Archives with a 64-bit symbol table ("/SYM64/") are supported.
+rm -f $t/g.a $t/h.a
+(cd $t; SYM64_THRESHOLD=0 llvm-ar --format=gnu rcs g.a a.o b.o)
+(cd $t; SYM64_THRESHOLD=0 llvm-ar --format=gnu rcsT h.a a.o b.o)
+
+link $t/g.a
+fgrep -q 'archive-lazy/g.a:(a.o)' $t/log
+! fgrep -q 'archive-lazy/g.a:(b.o)' $t/log || false
+$t/exe | grep -q 3
+
+link $t/h.a
+$t/exe | grep -q 3
+
+echo ' OK'
@@ -0,0 +1,40 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -c -g -o $t/a.o -xc -
+int main() {
+  return 0;
+}
+EOF
+
+# Make .debug_str large enough to be split into multiple shards.
+for i in $(seq 1 30000); do
+  echo "int some_function_name_that_is_long_enough_$i(int x) { return x + $i; }"
+done | cc -c -g -o $t/b.o -xc -
+
+link() {
+  ../mold -static -o $t/exe "$@" /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbeginT.o \
+    $t/a.o $t/b.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc_eh.a \
+    /usr/lib/x86_64-linux-gnu/libc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o
+}
+
+link -compress-debug-sections=none
+! readelf --sections $t/exe | grep -A1 .debug_info | grep -q C || false
+
+link -compress-debug-sections=zlib
+readelf --sections $t/exe | grep -A1 .debug_info | grep -q C
+readelf --sections $t/exe | grep -A1 .debug_str | grep -q C
+readelf -z --string-dump=.debug_str $t/exe | grep -q some_function_name_that_is_long_enough_29999
+readelf --debug-dump=info $t/exe | grep -q some_function_name_that_is_long_enough_1
+$t/exe
+
+echo ' OK'
@@ -0,0 +1,36 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -c -g -gz=zlib -o $t/a.o -xc -
+int main() {
+  return 0;
+}
+EOF
+
+readelf --sections $t/a.o | grep -A1 .debug_info | grep -q C
+
+cat <<EOF | cc -c -g -gz=zlib -o $t/b.o -xc -
+int some_function_name(int x) {
+  return x + 1;
+}
+EOF
+
+../mold -static -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
+  /usr/lib/x86_64-linux-gnu/crti.o \
+  /usr/lib/gcc/x86_64-linux-gnu/9/crtbeginT.o \
+  $t/a.o $t/b.o \
+  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc_eh.a \
+  /usr/lib/x86_64-linux-gnu/libc.a \
+  /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+  /usr/lib/x86_64-linux-gnu/crtn.o
+
+! readelf --sections $t/exe | grep -A1 .debug_info | grep -q C || false
+readelf --string-dump=.debug_str $t/exe | grep -q some_function_name
+readelf --debug-dump=info $t/exe | grep -q some_function_name
+$t/exe
+
+echo ' OK'
@@ -0,0 +1,52 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+.globl _start, live_fn, dead_fn
+
+.section .text._start,"ax",@progbits
+_start:
+  .cfi_startproc
+  call live_fn
+  ret
+  .cfi_endproc
+
+.section .text.live_fn,"ax",@progbits
+live_fn:
+  .cfi_startproc
+  ret
+  .cfi_endproc
+
+.section .text.dead_fn,"ax",@progbits
+dead_fn:
+  .cfi_startproc
+  ret
+  .cfi_endproc
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -x assembler -
+.globl foo
+.text
+foo:
+  .cfi_startproc
+  ret
+  .cfi_endproc
+EOF
+
+../mold -static -o $t/exe $t/a.o $t/b.o
+readelf --debug-dump=frames $t/exe > $t/log
+[ "$(grep -c ' CIE' $t/log)" = 1 ]
+[ "$(grep -c ' FDE' $t/log)" = 4 ]
+! readelf --segments $t/exe | grep -q GNU_EH_FRAME || false
+
+../mold -static -gc-sections -eh-frame-hdr -o $t/exe $t/a.o $t/b.o
+readelf --debug-dump=frames $t/exe > $t/log
+[ "$(grep -c ' CIE' $t/log)" = 1 ]
+[ "$(grep -c ' FDE' $t/log)" = 2 ]
+readelf --segments $t/exe | grep -q GNU_EH_FRAME
+readelf --sections $t/exe | grep -q .eh_frame_hdr
+
+echo ' OK'
@@ -0,0 +1,56 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+.globl _start, live_fn, dead_fn, live_var, dead_var
+
+.section .text._start,"ax",@progbits
+_start:
+  call live_fn
+  mov live_var(%rip), %rax
+  ret
+
+.section .text.live_fn,"ax",@progbits
+live_fn:
+  ret
+
+.section .text.dead_fn,"ax",@progbits
+dead_fn:
+  call live_fn
+  ret
+
+.section .data.live_var,"aw",@progbits
+live_var:
+  .quad 0
+
+.section .data.dead_var,"aw",@progbits
+dead_var:
+  .quad dead_fn
+
+.section .init_array,"aw",@init_array
+  .quad init_fn
+
+.section .text.init_fn,"ax",@progbits
+init_fn:
+  ret
+EOF
+
+../mold -static -o $t/exe $t/a.o
+readelf --symbols $t/exe > $t/log
+grep -q live_fn $t/log
+grep -q dead_fn $t/log
+grep -q live_var $t/log
+grep -q dead_var $t/log
+
+../mold -static -gc-sections -o $t/exe $t/a.o
+readelf --symbols $t/exe > $t/log
+grep -q live_fn $t/log
+! grep -q dead_fn $t/log || false
+grep -q live_var $t/log
+! grep -q dead_var $t/log || false
+grep -q init_fn $t/log
+
+echo ' OK'
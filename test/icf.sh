@@ -0,0 +1,64 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -x assembler -
+.globl _start, foo1, foo2, bar1, bar2, baz
+
+.section .text._start,"ax",@progbits
+_start:
+  call foo1
+  call foo2
+  call bar1
+  call bar2
+  lea baz(%rip), %rax
+  ret
+
+.section .text.foo1,"ax",@progbits
+foo1:
+  mov \$1, %eax
+  call bar1
+  ret
+
+.section .text.foo2,"ax",@progbits
+foo2:
+  mov \$1, %eax
+  call bar2
+  ret
+
+.section .text.bar1,"ax",@progbits
+bar1:
+  mov \$2, %eax
+  ret
+
+.section .text.bar2,"ax",@progbits
+bar2:
+  mov \$2, %eax
+  ret
+
+.section .text.baz,"ax",@progbits
+baz:
+  mov \$2, %eax
+  ret
+EOF
+
+addr() {
+  readelf --symbols $t/exe | grep " $1\$" | awk '{ print $2 }'
+}
+
+../mold -static -o $t/exe $t/a.o
+[ "$(addr foo1)" != "$(addr foo2)" ]
+[ "$(addr bar1)" != "$(addr bar2)" ]
+
+../mold -static -icf=safe -o $t/exe $t/a.o
+[ "$(addr foo1)" = "$(addr foo2)" ]
+[ "$(addr bar1)" = "$(addr bar2)" ]
+[ "$(addr bar1)" != "$(addr baz)" ]
+
+../mold -static -icf=all -o $t/exe $t/a.o
+[ "$(addr foo1)" = "$(addr foo2)" ]
+[ "$(addr bar1)" = "$(addr baz)" ]
+
+echo ' OK'
@@ -0,0 +1,62 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+rm -f $t/exe $t/exe.incremental
+
+cat <<EOF | cc -c -o $t/a.o -xc -
+#include <stdio.h>
+int foo();
+int main() {
+  printf("%d\n", foo());
+  return 0;
+}
+EOF
+
+cat <<EOF | cc -c -o $t/b.o -xc -
+int foo() { return 3; }
+EOF
+
+link() {
+  ../mold -o $t/exe -incremental -stat /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    $t/a.o $t/b.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o > $t/log
+}
+
+link
+[ -f $t/exe.incremental ]
+$t/exe | grep -q 3
+! grep -q incremental_files $t/log || false
+
+# A small change is patched in place.
+sleep 0.1
+cat <<EOF | cc -c -o $t/b.o -xc -
+int foo() { return 5; }
+EOF
+
+link
+$t/exe | grep -q 5
+grep -q 'incremental_files=1' $t/log
+
+# A change that doesn't fit in the reserved space needs a full link.
+sleep 0.1
+cat <<EOF | cc -c -o $t/b.o -xc -
+int bar(int x) { return x * 3; }
+int baz(int x) { return bar(x) + bar(x + 1) * 7; }
+int foo() { return baz(1) + baz(2) + baz(3) + baz(4) + baz(5) + baz(6); }
+EOF
+
+link
+$t/exe | grep -q 630
+! grep -q incremental_files $t/log || false
+
+echo ' OK'
@@ -0,0 +1,34 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+int main() { printf("Hello world\n"); }
+EOF
+
+link() {
+  ../mold -static -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbeginT.o \
+    $t/a.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc_eh.a \
+    /usr/lib/x86_64-linux-gnu/libc.a \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o "$@"
+}
+
+# If io_uring is not available, files are mmap'ed as usual.
+link -input-io=io_uring
+$t/exe | grep -q 'Hello world'
+
+link -input-io=mmap
+$t/exe | grep -q 'Hello world'
+
+! link -input-io=foo 2> $t/log || false
+grep -q 'unknown --input-io argument: foo' $t/log
+
+echo ' OK'
@@ -0,0 +1,56 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+mold=$(pwd)/../mold
+
+cat <<EOF2 | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+void hello() { printf("Hello world\n"); }
+EOF2
+
+cat <<EOF2 | cc -o $t/b.o -c -xc -
+void hello();
+int main() { hello(); }
+EOF2
+
+link() {
+  $mold /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    "$@" \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o
+}
+
+rm -rf $t/lib1 $t/lib2 $t/lib3 $t/exe
+mkdir -p $t/lib1 $t/lib2 $t/lib3
+
+# A library is found in a later directory after earlier ones are listed.
+ar rcs $t/lib2/libhello.a $t/a.o
+link -o $t/exe $t/b.o -L$t/lib1 -L$t/lib2 -lhello
+$t/exe | grep -q 'Hello world'
+
+# A library in a directory that can be searched but not listed is found.
+ar rcs $t/lib3/libhello2.a $t/a.o
+chmod 111 $t/lib3
+link -o $t/exe $t/b.o -L$t/lib1 -L$t/lib3 -lhello2
+chmod 755 $t/lib3
+$t/exe | grep -q 'Hello world'
+
+# A library created after the preload daemon has started is found.
+rm -f $t/exe
+link -o $t/exe $t/b.o -L$t/lib1 -L$t/lib2 -lhello -preload
+! [ -e $t/exe ]
+
+ar rcs $t/lib1/libhello3.a $t/a.o
+link -o $t/exe $t/b.o -L$t/lib1 -L$t/lib2 -lhello3
+$t/exe | grep -q 'Hello world'
+
+echo ' OK'
@@ -0,0 +1,57 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+for i in a b; do
+  cat <<EOF | cc -o $t/$i.o -c -x assembler -
+  .section .rodata.cst8, "aM", @progbits, 8
+  .align 8
+.L.num:
+  .quad 0x1234567890
+  .quad 42
+
+  .section .rodata.str4.4, "aMS", @progbits, 4
+  .align 4
+.L.str:
+  .long 'x', 0
+  .long 'h', 'e', 'l', 'l', 'o', 0
+
+  .text
+  .globl get_num_$i, get_str_$i
+get_num_$i:
+  lea .L.num(%rip), %rax
+  ret
+get_str_$i:
+  lea .L.str+8(%rip), %rax
+  ret
+EOF
+done
+
+cat <<EOF | cc -o $t/c.o -c -xc -
+#include <stdio.h>
+#include <wchar.h>
+
+long *get_num_a(); long *get_num_b();
+wchar_t *get_str_a(); wchar_t *get_str_b();
+
+int main() {
+  printf("%d %d %lx %ls\n", get_num_a() == get_num_b(),
+         get_str_a() == get_str_b(), *get_num_a(), get_str_a());
+}
+EOF
+
+../mold -static -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
+  /usr/lib/x86_64-linux-gnu/crti.o \
+  /usr/lib/gcc/x86_64-linux-gnu/9/crtbeginT.o \
+  $t/a.o $t/b.o $t/c.o \
+  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+  /usr/lib/gcc/x86_64-linux-gnu/9/libgcc_eh.a \
+  /usr/lib/x86_64-linux-gnu/libc.a \
+  /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+  /usr/lib/x86_64-linux-gnu/crtn.o
+
+$t/exe | grep -q '^1 1 1234567890 hello$'
+
+echo ' OK'
@@ -0,0 +1,53 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+mold=$(pwd)/../mold
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+void hello() { printf("Hello world\n"); }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+void hello();
+int main() { hello(); }
+EOF
+
+cat <<EOF | cc -o $t/c.o -c -xc -
+void hello();
+int main() { hello(); hello(); }
+EOF
+
+link() {
+  $mold /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    "$@" \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o
+}
+
+rm -f $t/exe1 $t/exe2
+
+link -o $t/exe1 $t/a.o $t/b.o -preload
+! [ -e $t/exe1 ]
+
+# A daemon serves link commands different from the one it was started
+# with, reusing files it has already parsed.
+link -o $t/exe2 $t/a.o $t/c.o -stat > $t/log
+grep -q 'preloaded_files=[1-9]' $t/log
+$t/exe2 | grep -q 'Hello world'
+
+# Relative paths from another directory refer to the same files.
+(cd $t && link -o exe1 ./a.o ./b.o -stat > $t/log)
+grep -q 'preloaded_files=[1-9]' $t/log
+$t/exe1 | grep -q 'Hello world'
+
+echo ' OK'
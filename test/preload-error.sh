@@ -0,0 +1,43 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+mold=$(pwd)/../mold
+
+cat <<EOF2 | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+void hello() { printf("Hello world\n"); }
+EOF2
+
+cat <<EOF2 | cc -o $t/b.o -c -xc -
+void hello();
+int main() { hello(); }
+EOF2
+
+link() {
+  $mold /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    "$@" \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o
+}
+
+rm -f $t/exe
+link -o $t/exe $t/a.o $t/b.o -preload
+! [ -e $t/exe ]
+
+# A request that fails doesn't take down the daemon.
+! link -o $t/exe $t/a.o $t/b.o $t/nonexistent.o 2> /dev/null
+
+link -o $t/exe $t/a.o $t/b.o -stat > $t/log
+grep -q 'preloaded_files=[1-9]' $t/log
+$t/exe | grep -q 'Hello world'
+
+echo ' OK'
@@ -0,0 +1,53 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+mold=$(pwd)/../mold
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+int foo();
+int main() { printf("%d\n", foo()); }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+int foo() { return 3; }
+EOF
+
+link() {
+  $mold /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    $t/a.o $t/b.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o "$@"
+}
+
+link -o $t/exe -preload -daemon-timeout=3
+link -o $t/exe -stat | grep preloaded_files > $t/log1
+$t/exe | grep -q 3
+
+# A rewritten file is re-parsed by the daemon in the background,
+# so all input files are still served from the daemon's cache.
+cat <<EOF | cc -o $t/b.o -c -xc -
+int foo() { return 5; }
+EOF
+sleep 1
+
+link -o $t/exe -stat | grep preloaded_files > $t/log2
+diff $t/log1 $t/log2
+$t/exe | grep -q 5
+
+# The daemon exits if it is idle for --daemon-timeout seconds.
+sleep 4
+link -o $t/exe -stat > $t/log
+grep -q 'preloaded_files=0$' $t/log
+$t/exe | grep -q 5
+
+echo ' OK'
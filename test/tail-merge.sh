@@ -0,0 +1,41 @@
+#!/bin/bash
+set -e
+echo -n "Testing $(basename -s .sh $0) ..."
+t=$(pwd)/tmp/$(basename -s .sh $0)
+mkdir -p $t
+
+cat <<EOF | cc -o $t/a.o -c -xc -
+#include <stdio.h>
+extern const char *bar;
+const char *foobar = "foobar";
+int main() { printf("%s %s\n", foobar, bar); }
+EOF
+
+cat <<EOF | cc -o $t/b.o -c -xc -
+const char *bar = "bar";
+EOF
+
+link() {
+  ../mold -o $t/exe /usr/lib/x86_64-linux-gnu/crt1.o \
+    /usr/lib/x86_64-linux-gnu/crti.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtbegin.o \
+    $t/a.o $t/b.o \
+    /usr/lib/gcc/x86_64-linux-gnu/9/libgcc.a \
+    /usr/lib/x86_64-linux-gnu/libgcc_s.so.1 \
+    /lib/x86_64-linux-gnu/libc.so.6 \
+    /usr/lib/x86_64-linux-gnu/libc_nonshared.a \
+    /lib/x86_64-linux-gnu/ld-linux-x86-64.so.2 \
+    /usr/lib/gcc/x86_64-linux-gnu/9/crtend.o \
+    /usr/lib/x86_64-linux-gnu/crtn.o -stat "$@" > $t/log
+}
+
+link
+$t/exe | grep -q 'foobar bar'
+! grep -q 'tail_merged_bytes=[1-9]' $t/log || false
+
+# With -O2, "bar" is folded into the tail of "foobar".
+link -O2
+$t/exe | grep -q 'foobar bar'
+grep -q 'tail_merged_bytes=[1-9]' $t/log
+
+echo ' OK'